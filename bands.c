@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Three-band crossover and metering, to colour the waveform
+ *
+ * Two one-pole low-pass filters split the audio into bands: below
+ * the lower crossover, between the two, and above the upper. A meter
+ * on each band has a fast attack and slow release, so its value can
+ * be taken at any resolution coarser than a few samples.
+ */
+
+#include <math.h>
+
+#include "bands.h"
+
+#define LOW_CROSSOVER 250.0 /* Hz */
+#define HIGH_CROSSOVER 2500.0
+
+#define ATTACK (1.0f / 8)
+#define RELEASE (1.0f / 512)
+
+/* The meters of the bands are run together, as a vector with a
+ * spare lane */
+
+typedef float vec4f __attribute__((vector_size(16)));
+typedef int vec4i __attribute__((vector_size(16)));
+
+/*
+ * Return: coefficient of a one-pole low-pass filter
+ */
+
+static float coefficient(double f, int rate)
+{
+    return 1.0 - exp(-2.0 * M_PI * f / rate);
+}
+
+void bands_init(struct bands *b, int rate)
+{
+    int n;
+
+    b->rate = rate;
+    b->low_k = coefficient(LOW_CROSSOVER, rate);
+    b->high_k = coefficient(HIGH_CROSSOVER, rate);
+    b->low = 0.0;
+    b->mid = 0.0;
+
+    for (n = 0; n < BANDS; n++)
+        b->env[n] = 0.0;
+}
+
+/*
+ * Meter the level of each band
+ *
+ * Both the attack and release are worked out, and the choice made
+ * without a branch, which would be mispredicted for much of the
+ * audio. Only a multiply and add are then in the path from one
+ * sample to the next.
+ */
+
+static inline vec4f meter(vec4f env, vec4f v)
+{
+    vec4f attack, release;
+    vec4i up;
+
+    v = (vec4f)((vec4i)v & 0x7fffffff); /* fabsf() */
+
+    attack = env * (1.0f - ATTACK) + v * ATTACK;
+    release = env * (1.0f - RELEASE) + v * RELEASE;
+    up = v > env;
+
+    return (vec4f)((up & (vec4i)attack) | (~up & (vec4i)release));
+}
+
+static inline unsigned char to_byte(float env)
+{
+    return env >= 255.0f * 128 ? 255 : (unsigned char)(env / 128);
+}
+
+/*
+ * Split stereo audio into bands and meter them
+ *
+ * The meters for the sample at 'offset' + n are written to
+ * out[(offset + n) >> shift], so that each entry of the output is
+ * the meters at the last sample of 2^shift samples.
+ */
+
+void bands_process(struct bands *b, const signed short *pcm,
+                   unsigned int offset, unsigned int samples,
+                   unsigned char (*out)[BANDS], unsigned int shift)
+{
+    unsigned int n, end;
+    float low, lowmid, low_k, high_k;
+    vec4f env;
+
+    /* Work on local copies of the state, which the compiler can
+     * keep in registers */
+
+    low = b->low;
+    lowmid = b->mid;
+    low_k = b->low_k;
+    high_k = b->high_k;
+    env = (vec4f){ b->env[BAND_LOW], b->env[BAND_MID], b->env[BAND_HIGH] };
+
+    end = offset + samples;
+
+    for (n = offset; n < end; n++) {
+        float x;
+        unsigned char *o;
+
+        x = (pcm[0] + pcm[1]) * 0.5f;
+        pcm += 2;
+
+        /* Rather than low += (x - low) * k, so that there is less
+         * in the path from one sample to the next */
+
+        low = low * (1.0f - low_k) + x * low_k;
+        lowmid = lowmid * (1.0f - high_k) + x * high_k;
+
+        env = meter(env, (vec4f){ low, lowmid - low, x - lowmid });
+
+        /* Only the last sample of each entry need be stored */
+
+        if (((n + 1) & ((1 << shift) - 1)) != 0 && n + 1 != end)
+            continue;
+
+        o = out[n >> shift];
+        o[BAND_LOW] = to_byte(env[BAND_LOW]);
+        o[BAND_MID] = to_byte(env[BAND_MID]);
+        o[BAND_HIGH] = to_byte(env[BAND_HIGH]);
+    }
+
+    b->low = low;
+    b->mid = lowmid;
+    b->env[BAND_LOW] = env[BAND_LOW];
+    b->env[BAND_MID] = env[BAND_MID];
+    b->env[BAND_HIGH] = env[BAND_HIGH];
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Energy of audio in low, mid and high frequency bands
+ */
+
+#ifndef BANDS_H
+#define BANDS_H
+
+#define BANDS 3
+
+#define BAND_LOW 0
+#define BAND_MID 1
+#define BAND_HIGH 2
+
+struct bands {
+    int rate;
+    float low_k, high_k, /* filter coefficients */
+        low, mid; /* filter state */
+    float env[BANDS];
+};
+
+void bands_init(struct bands *b, int rate);
+
+void bands_process(struct bands *b, const signed short *pcm,
+                   unsigned int offset, unsigned int samples,
+                   unsigned char (*out)[BANDS], unsigned int shift);
+
+#endif
@@ -0,0 +1,730 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Analysis of the tempo of tracks, in the background
+ *
+ * Onsets are found from the rise in energy of the audio, in a band
+ * for the kick drum and another for the hi-hats and snare. The
+ * tempo is the one at which the onsets best repeat, favouring
+ * tempos around 120BPM; it is then refined, along with the position
+ * of the first beat, by folding the onsets of the whole track over
+ * the period of one beat. If the half beats are as strong as the
+ * beats, the tempo is doubled.
+ *
+ * Tracks loaded on a deck, for which the tempo is not known, are
+ * analysed once their import has completed. This is done by threads
+ * which run only when nothing else wants the CPU, including the
+ * importers. The results are kept in a file and given to the
+ * library, in the same way as a tempo from the scan.
+ */
+
+#define _GNU_SOURCE /* syscall() */
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "beat.h"
+#include "external.h"
+#include "mutex.h"
+#include "rig.h"
+#include "status.h"
+
+#define HOP 512 /* samples for each value of onset strength */
+#define LOW_HZ 150.0 /* top of the band of the kick drum */
+#define SMOOTH 16 /* frames either side for the local mean */
+
+#define MIN_BPM 60.0
+#define MAX_BPM 200.0
+#define LIKELY_BPM 120.0
+#define SPREAD 0.8 /* octaves */
+#define HARMONICS 4 /* beats of repetition used to score a tempo */
+#define COARSE_STEP 0.05 /* BPM */
+#define FINE_RANGE 0.5 /* BPM either side of the coarse result */
+#define FINE_STEP 0.01 /* BPM */
+#define PHASES 64 /* divisions of one beat */
+#define OCTAVE 0.9 /* strength of half beats, to be beats too */
+
+#define MIN_SECONDS 10
+
+#define MIN(x,y) ((x)<(y)?(x):(y))
+
+/* State of the analysis of a single track */
+
+enum {
+    WAITING, /* for the import to complete */
+    QUEUED,
+    RUNNING,
+    DONE,
+    FAILED
+};
+
+struct job {
+    struct list jobs;
+    int state;
+    struct record *record;
+    struct track *track; /* reference is held, unless WAITING */
+    struct observer on_destroy; /* while WAITING */
+    struct beat beat;
+};
+
+struct store beats_store = STORE_INIT("beats");
+
+static struct library *library;
+static pthread_t thread[BEAT_MAX_THREADS];
+static size_t nthreads;
+
+/* Jobs are added and removed by the rig, with both locks held */
+
+static mutex lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static struct list jobs = LIST_INIT(jobs);
+static bool quit;
+
+/*
+ * Find the onset strength for each frame of HOP samples: the rise
+ * in energy of the low and high frequencies, in proportion
+ */
+
+static void onsets(const struct track *t, float *odf, size_t frames)
+{
+    size_t f, n;
+    float a, lp, last, last_low, last_high;
+
+    a = 1.0 - exp(-2.0 * M_PI * LOW_HZ / t->rate);
+    lp = 0.0;
+    last = 0.0;
+    last_low = 0.0;
+    last_high = 0.0;
+
+    for (f = 0; f < frames; f++) {
+        const signed short *pcm;
+        float low, high;
+        size_t s;
+
+        s = f * HOP; /* frames do not cross a block */
+        pcm = t->block[s / TRACK_BLOCK_SAMPLES]->pcm
+            + (s % TRACK_BLOCK_SAMPLES) * TRACK_CHANNELS;
+
+        low = 0.0;
+        high = 0.0;
+
+        for (n = 0; n < HOP; n++) {
+            float x, d;
+
+            x = pcm[n * TRACK_CHANNELS] + pcm[n * TRACK_CHANNELS + 1];
+            lp += a * (x - lp);
+            d = x - last;
+            last = x;
+
+            low += lp * lp;
+            high += d * d;
+        }
+
+        if (fabsf(lp) < 1e-3) /* avoid denormals in silence */
+            lp = 0.0;
+
+        low = logf(low + 1.0);
+        high = logf(high + 1.0);
+
+        odf[f] = fmaxf(low - last_low, 0.0) + fmaxf(high - last_high, 0.0);
+
+        last_low = low;
+        last_high = high;
+    }
+
+    odf[0] = 0.0; /* rise from nothing */
+}
+
+/*
+ * Keep only the onsets which stand out from the local mean
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ */
+
+static int detrend(float *odf, size_t frames)
+{
+    size_t f;
+    double *sum;
+
+    sum = malloc(sizeof *sum * (frames + 1));
+    if (sum == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    sum[0] = 0.0;
+    for (f = 0; f < frames; f++)
+        sum[f + 1] = sum[f] + odf[f];
+
+    for (f = 0; f < frames; f++) {
+        size_t lo, hi;
+        float mean;
+
+        lo = f > SMOOTH ? f - SMOOTH : 0;
+        hi = MIN(f + SMOOTH + 1, frames);
+        mean = (sum[hi] - sum[lo]) / (hi - lo);
+
+        odf[f] = fmaxf(odf[f] - mean, 0.0);
+    }
+
+    free(sum);
+    return 0;
+}
+
+/*
+ * Autocorrelation of the onsets, for lags up to the given number
+ *
+ * Pre: odf is followed by 'lags' values of zero
+ */
+
+static void autocorrelate(const float *odf, size_t frames,
+                          float *acf, size_t lags)
+{
+    size_t f, l;
+
+    for (l = 0; l < lags; l++)
+        acf[l] = 0.0;
+
+    for (f = 0; f < frames; f++) {
+        float x;
+
+        x = odf[f];
+        if (x == 0.0) /* most are, once detrended */
+            continue;
+
+        for (l = 0; l < lags; l++)
+            acf[l] += x * odf[f + l];
+    }
+
+    for (l = 0; l < lags; l++)
+        acf[l] /= frames - MIN(l, frames - 1);
+}
+
+/*
+ * Return: the value at a position between two entries
+ */
+
+static double interpolate(const float *x, double i)
+{
+    size_t n;
+
+    n = i;
+    return x[n] + (x[n + 1] - x[n]) * (i - n);
+}
+
+/*
+ * Return: how likely a tempo is, before any analysis
+ */
+
+static double prior(double bpm)
+{
+    double x;
+
+    x = log2(bpm / LIKELY_BPM) / SPREAD;
+    return exp(-0.5 * x * x);
+}
+
+/*
+ * Return: the tempo at which the onsets best repeat, or 0.0 if
+ * there are none
+ */
+
+static double estimate(const float *acf, double fps)
+{
+    unsigned int n, steps;
+    double best, tempo;
+
+    best = 0.0;
+    tempo = 0.0;
+    steps = (MAX_BPM - MIN_BPM) / COARSE_STEP;
+
+    for (n = 0; n <= steps; n++) {
+        unsigned int k;
+        double bpm, period, score;
+
+        bpm = MIN_BPM + n * COARSE_STEP;
+        period = 60.0 * fps / bpm;
+
+        /* Music moves in halves of a beat too, which tells the true
+         * tempo from 2/3 or 3/2 of it */
+
+        score = 0.0;
+        for (k = 1; k <= HARMONICS; k++) {
+            score += interpolate(acf, period * k);
+            score += 0.5 * interpolate(acf, period * (k - 0.5));
+        }
+        score *= prior(bpm);
+
+        if (score > best) {
+            best = score;
+            tempo = bpm;
+        }
+    }
+
+    return tempo;
+}
+
+/*
+ * Fold the onsets over the period of one beat, which gives the
+ * sharpest peak at the true tempo
+ *
+ * Return: strength of the onsets at the peak
+ * Post: *phase is the position of the peak, in frames
+ * Post: *half is the strength half a beat from the peak
+ */
+
+static double fold(const float *odf, size_t frames, double period,
+                   double *phase, double *half)
+{
+    size_t f, n, best;
+    double hist[PHASES], sharp[PHASES], scale, p, d, l, r;
+
+    for (n = 0; n < PHASES; n++)
+        hist[n] = 0.0;
+
+    scale = PHASES / period;
+    p = 0.0;
+
+    for (f = 0; f < frames; f++) {
+        if (odf[f] != 0.0)
+            hist[(size_t)p] += odf[f];
+
+        p += scale;
+        if (p >= PHASES)
+            p -= PHASES;
+    }
+
+    best = 0;
+    for (n = 0; n < PHASES; n++) {
+        sharp[n] = hist[(n + PHASES - 1) % PHASES] + 2.0 * hist[n]
+            + hist[(n + 1) % PHASES];
+
+        if (sharp[n] > sharp[best])
+            best = n;
+    }
+
+    /* Between divisions, from the curve through the neighbours */
+
+    l = sharp[(best + PHASES - 1) % PHASES];
+    r = sharp[(best + 1) % PHASES];
+    d = l - 2.0 * sharp[best] + r;
+    d = d < 0.0 ? 0.5 * (l - r) / d : 0.0;
+
+    *phase = (best + 0.5 + d) / scale;
+    *half = sharp[(best + PHASES / 2) % PHASES];
+    return sharp[best];
+}
+
+/*
+ * Analyse the tempo of a track
+ *
+ * Return: 0 on success, or -1 if no tempo was found
+ * Pre: track is not importing
+ */
+
+int beat_analyse(const struct track *t, struct beat *b)
+{
+    size_t frames, lags;
+    double fps, tempo, best, half, phase, period;
+    unsigned int n, steps;
+    float *odf, *acf;
+    int r;
+
+    if (t->length < MIN_SECONDS * t->rate)
+        return -1;
+
+    frames = t->length / HOP;
+    fps = (double)t->rate / HOP;
+    lags = ceil(HARMONICS * 60.0 * fps / MIN_BPM) + 2;
+
+    odf = malloc(sizeof *odf * (frames + lags));
+    acf = malloc(sizeof *acf * lags);
+    if (odf == NULL || acf == NULL) {
+        perror("malloc");
+        free(odf);
+        free(acf);
+        return -1;
+    }
+
+    r = -1;
+    phase = 0.0;
+    half = 0.0;
+
+    onsets(t, odf, frames);
+    if (detrend(odf, frames) == -1)
+        goto out;
+
+    for (n = 0; n < lags; n++)
+        odf[frames + n] = 0.0;
+
+    autocorrelate(odf, frames, acf, lags);
+
+    tempo = estimate(acf, fps);
+    if (tempo == 0.0)
+        goto out;
+
+    /* Refine the tempo, and find where the beats fall */
+
+    best = 0.0;
+    steps = 2.0 * FINE_RANGE / FINE_STEP;
+
+    for (n = 0; n <= steps; n++) {
+        double bpm, strength, p, h;
+
+        bpm = tempo - FINE_RANGE + n * FINE_STEP;
+        strength = fold(odf, frames, 60.0 * fps / bpm, &p, &h);
+
+        if (strength > best) {
+            best = strength;
+            half = h;
+            b->bpm = bpm;
+            phase = p;
+        }
+    }
+
+    /* Half beats which are nearly as strong as the beats are beats
+     * too, and the tempo is twice that found; the prior favours the
+     * lower of the two above 120BPM */
+
+    if (2.0 * b->bpm <= MAX_BPM && half > OCTAVE * best)
+        b->bpm *= 2.0;
+
+    period = 60.0 / b->bpm;
+    b->offset = fmod(phase * HOP / t->rate + period, period);
+
+    r = 0;
+out:
+    free(odf);
+    free(acf);
+    return r;
+}
+
+/*
+ * Get the result of an earlier analysis of a track
+ *
+ * Return: true if the track has been analysed, otherwise false
+ */
+
+bool beat_get(const char *path, struct beat *b)
+{
+    double v[2];
+
+    if (store_get(&beats_store, path, v, 2) < 2)
+        return false;
+
+    if (v[0] == HUGE_VAL || v[1] == HUGE_VAL)
+        return false;
+
+    b->bpm = v[0];
+    b->offset = v[1];
+
+    return true;
+}
+
+/*
+ * Return: a job which is ready for a worker, or NULL if none
+ * Pre: lock is held
+ */
+
+static struct job* next_job(void)
+{
+    struct job *j;
+
+    list_for_each(j, &jobs, jobs) {
+        if (j->state == QUEUED)
+            return j;
+    }
+
+    return NULL;
+}
+
+/*
+ * Lower the priority of the calling thread below that of anything
+ * else, including the importers
+ *
+ * Failure is not fatal; the thread continues as it is.
+ */
+
+static void make_idle(void)
+{
+    int r;
+    struct sched_param sp = {
+        .sched_priority = 0
+    };
+
+    make_background(syscall(SYS_gettid));
+
+    r = pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp);
+    if (r != 0) {
+        errno = r;
+        perror("pthread_setschedparam");
+    }
+}
+
+static void* worker(void *p)
+{
+    make_idle();
+
+    mutex_lock(&lock);
+
+    for (;;) {
+        struct job *j = NULL;
+        int r;
+
+        while (!quit && (j = next_job()) == NULL)
+            pthread_cond_wait(&work, &lock);
+
+        if (quit)
+            break;
+
+        j->state = RUNNING;
+        mutex_unlock(&lock);
+
+        r = beat_analyse(j->track, &j->beat);
+        if (r == 0) {
+            double v[2] = { j->beat.bpm, j->beat.offset };
+            store_put(&beats_store, j->record->pathname, v, 2);
+        }
+
+        mutex_lock(&lock);
+        j->state = (r == 0) ? DONE : FAILED;
+        mutex_unlock(&lock);
+
+        rig_wake();
+
+        mutex_lock(&lock);
+    }
+
+    mutex_unlock(&lock);
+
+    return NULL;
+}
+
+/*
+ * Ask the workers to finish and wait for them
+ */
+
+static void stop_workers(void)
+{
+    size_t n;
+
+    mutex_lock(&lock);
+    quit = true;
+    pthread_cond_broadcast(&work);
+    mutex_unlock(&lock);
+
+    for (n = 0; n < nthreads; n++) {
+        if (pthread_join(thread[n], NULL) != 0)
+            abort();
+    }
+
+    nthreads = 0;
+}
+
+/*
+ * Start the given number of threads to analyse tracks for the
+ * library
+ *
+ * Return: 0 on success or -1 if the threads could not be started
+ * Post: tracks are not analysed, unless 0 is returned
+ */
+
+int beat_init(struct library *lib, unsigned int threads)
+{
+    size_t n;
+
+    library = lib;
+    quit = false;
+    nthreads = 0;
+
+    for (n = 0; n < MIN(threads, BEAT_MAX_THREADS); n++) {
+        int r;
+
+        r = pthread_create(&thread[n], NULL, worker, NULL);
+        if (r != 0) {
+            errno = r;
+            perror("pthread_create");
+            stop_workers();
+            return -1;
+        }
+
+        nthreads++;
+    }
+
+    return 0;
+}
+
+/*
+ * Abandon any analysis which is waiting, and stop the threads
+ *
+ * Post: results of analysis so far are in the store
+ */
+
+void beat_clear(void)
+{
+    struct job *j, *x;
+
+    if (nthreads > 0)
+        stop_workers();
+
+    list_for_each_safe(j, x, &jobs, jobs) {
+        list_del(&j->jobs);
+        if (j->state == WAITING)
+            ignore(&j->on_destroy);
+        else
+            track_release(j->track);
+        free(j);
+    }
+}
+
+/*
+ * The track of a job which is waiting has been let go of before its
+ * import completed, so forget the job
+ *
+ * Pre: rig lock is held
+ */
+
+static void handle_destroy(struct observer *o, void *x)
+{
+    struct job *j = container_of(o, struct job, on_destroy);
+
+    assert(j->state == WAITING);
+    ignore(&j->on_destroy);
+
+    mutex_lock(&lock);
+    list_del(&j->jobs);
+    mutex_unlock(&lock);
+
+    free(j);
+}
+
+/*
+ * Analyse the tempo of a record, if it is not known, once the given
+ * track of it is imported
+ *
+ * No reference to the track is taken until its import has
+ * completed, so that the import is still cancelled if the track is
+ * let go of; the job goes with the track.
+ *
+ * Pre: rig lock is held
+ */
+
+void beat_request(struct record *r, struct track *t)
+{
+    struct job *j;
+
+    if (nthreads == 0 || r->bpm != 0.0)
+        return;
+
+    list_for_each(j, &jobs, jobs) {
+        if (j->record == r)
+            return;
+    }
+
+    j = malloc(sizeof *j);
+    if (j == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    j->state = WAITING;
+    j->record = r;
+    j->track = t;
+    watch(&j->on_destroy, &t->destroy, handle_destroy);
+
+    mutex_lock(&lock);
+    list_add_tail(&j->jobs, &jobs);
+    mutex_unlock(&lock);
+
+    beat_handle();
+}
+
+/*
+ * Take the result of analysis, and finish with the job
+ *
+ * Pre: job is not in the list
+ */
+
+static void finish(struct job *j)
+{
+    if (j->state == DONE) {
+        status_printf(STATUS_VERBOSE, "Tempo of '%s' found to be %0.2fBPM",
+                      j->record->title, j->beat.bpm);
+
+        if (j->record->bpm == 0.0)
+            library_set_bpm(library, j->record, j->beat.bpm);
+    }
+
+    track_release(j->track);
+    free(j);
+}
+
+/*
+ * Hand on tracks which have finished importing to the workers, and
+ * take the results of those which have been analysed
+ *
+ * Pre: rig lock is held
+ */
+
+void beat_handle(void)
+{
+    struct job *j, *x;
+    struct list finished;
+
+    if (list_empty(&jobs))
+        return;
+
+    list_init(&finished);
+
+    mutex_lock(&lock);
+
+    list_for_each_safe(j, x, &jobs, jobs) {
+        struct track *t = j->track;
+
+        if (j->state == WAITING && !track_is_importing(t)) {
+            ignore(&j->on_destroy);
+            track_acquire(t);
+
+            if (t->hole_start < t->hole_end) { /* import failed */
+                j->state = FAILED;
+            } else {
+                j->state = QUEUED;
+                pthread_cond_signal(&work);
+            }
+        }
+
+        if (j->state == DONE || j->state == FAILED) {
+            list_del(&j->jobs);
+            list_add_tail(&j->jobs, &finished);
+        }
+    }
+
+    mutex_unlock(&lock);
+
+    list_for_each_safe(j, x, &finished, jobs)
+        finish(j);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Analysis of the tempo of tracks, in the background
+ */
+
+#ifndef BEAT_H
+#define BEAT_H
+
+#include <stdbool.h>
+
+#include "library.h"
+#include "store.h"
+#include "track.h"
+
+#define BEAT_MAX_THREADS 4
+
+/* The result of analysis of a track */
+
+struct beat {
+    double bpm,
+        offset; /* of the first beat, in seconds; less than one beat */
+};
+
+extern struct store beats_store;
+
+int beat_analyse(const struct track *t, struct beat *b);
+bool beat_get(const char *path, struct beat *b);
+
+int beat_init(struct library *lib, unsigned int threads);
+void beat_clear(void);
+
+void beat_request(struct record *r, struct track *t);
+
+/* Used by the rig */
+
+void beat_handle(void);
+
+#endif
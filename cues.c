@@ -17,25 +17,55 @@
  *
  */
 
+#define _GNU_SOURCE /* asprintf() */
 #include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 
 #include "debug.h"
 #include "controller.h"
+#include "deck.h"
 #include "status.h"
+#include "store.h"
 #include "cues.h"
 #include "rig.h"
 
 static struct list cuess = LIST_INIT(cuess);
 
+struct store cues_store = STORE_INIT("cues");
+
+/*
+ * Initialise a set of cue points, with none set
+ */
+
 void cues_reset(struct cues *q)
+{
+    q->marker = NULL;
+    q->markers = 0;
+    q->size = 0;
+
+    cues_unset_all(q);
+}
+
+void cues_clear(struct cues *q)
+{
+    free(q->marker);
+}
+
+/*
+ * Unset every cue point
+ */
+
+void cues_unset_all(struct cues *q)
 {
     size_t n;
 
     for (n = 0; n < MAX_CUES; n++)
         q->position[n] = CUE_UNSET;
+
+    q->markers = 0;
 }
 
 /*
@@ -61,6 +91,34 @@ double cues_get(const struct cues *q, unsigned int label)
     return q->position[label];
 }
 
+/*
+ * Return: index of the first of the ordered cue points which is at or
+ * after the given position, or after it if 'after' is set
+ */
+
+static size_t search(const struct cues *q, double position, bool after)
+{
+    size_t lo, hi;
+
+    lo = 0;
+    hi = q->markers;
+
+    while (lo < hi) {
+        size_t mid;
+        double p;
+
+        mid = lo + (hi - lo) / 2;
+        p = q->marker[mid];
+
+        if (p < position || (after && p == position))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
 /*
  * Return: the previous cue point before the current position, or CUE_UNSET
  */
@@ -69,8 +127,11 @@ double cues_prev(const struct cues *q, double current)
 {
     size_t n;
     double r;
+    bool found;
 
-    r = CUE_UNSET;
+    n = search(q, current, false);
+    found = (n > 0);
+    r = found ? q->marker[n - 1] : 0.0;
 
     for (n = 0; n < MAX_CUES; n++) {
         double p;
@@ -79,11 +140,13 @@ double cues_prev(const struct cues *q, double current)
         if (p == CUE_UNSET)
             continue;
 
-        if (p > r && p < current)
+        if (p < current && (!found || p > r)) {
             r = p;
+            found = true;
+        }
     }
 
-    return r;
+    return found ? r : CUE_UNSET;
 }
 
 /*
@@ -95,7 +158,8 @@ double cues_next(const struct cues *q, double current)
     size_t n;
     double r;
 
-    r = CUE_UNSET;
+    n = search(q, current, true);
+    r = n < q->markers ? q->marker[n] : CUE_UNSET;
 
     for (n = 0; n < MAX_CUES; n++) {
         double p;
@@ -111,6 +175,75 @@ double cues_next(const struct cues *q, double current)
     return r;
 }
 
+/*
+ * Count the cue points in a range, so that they can be shown along
+ * the overview of a track without looking at every one
+ *
+ * Return: number of cue points from 'from' (inclusive) to 'to'
+ * (exclusive)
+ */
+
+size_t cues_count(const struct cues *q, double from, double to)
+{
+    size_t n, count;
+
+    if (to <= from)
+        return 0;
+
+    count = search(q, to, false) - search(q, from, false);
+
+    for (n = 0; n < MAX_CUES; n++) {
+        double p;
+
+        p = q->position[n];
+        if (p != CUE_UNSET && p >= from && p < to)
+            count++;
+    }
+
+    return count;
+}
+
+/*
+ * Add a cue point, in order, to those which are not labelled
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ * Pre: rig lock is held
+ */
+
+int cues_add(struct cues *q, double position)
+{
+    size_t n;
+
+    rt_not_allowed();
+    assert(position != CUE_UNSET);
+
+    n = search(q, position, false);
+    if (n < q->markers && q->marker[n] == position)
+        return 0; /* already there */
+
+    if (q->markers == q->size) {
+        double *m;
+        size_t size;
+
+        size = q->size == 0 ? 32 : q->size * 2;
+        m = realloc(q->marker, sizeof *m * size);
+        if (m == NULL) {
+            perror("realloc");
+            return -1;
+        }
+
+        q->marker = m;
+        q->size = size;
+    }
+
+    memmove(&q->marker[n + 1], &q->marker[n],
+            sizeof *q->marker * (q->markers - n));
+    q->marker[n] = position;
+    q->markers++;
+
+    return 0;
+}
+
 static void cues_string_free(char **p)
 {
     char **a = p + 3;
@@ -119,12 +252,29 @@ static void cues_string_free(char **p)
         free(*a);
         a++;
     }
+
+    free(p);
 }
 
-static int cues_string(struct cues *q, char **p, const char *path, const char *cmd )
+/*
+ * Make the arguments to the cueloader: each labelled cue point in
+ * turn, followed by the others in order
+ *
+ * Return: NULL-terminated array, or NULL on memory allocation failure
+ */
+
+static char** cues_string(struct cues *q, const char *path, const char *cmd)
 {
-    int n;
-    char **a = p;
+    size_t n;
+    char **p, **a;
+
+    p = malloc(sizeof *p * (3 + MAX_CUES + q->markers + 1));
+    if (p == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    a = p;
 
     *a = "cueloader";
     a++;
@@ -135,35 +285,42 @@ static int cues_string(struct cues *q, char **p, const char *path, const char *c
     *a = (char*)path;
     a++;
 
-    for (n = 0; n < MAX_CUES; n++) {
+    for (n = 0; n < MAX_CUES + q->markers; n++) {
+        double x;
+        int r;
 
-        if ((*a = malloc(15)) == NULL)
-            return -1;
+        x = n < MAX_CUES ? q->position[n] : q->marker[n - MAX_CUES];
 
-        if (q->position[n] == CUE_UNSET) 
-            sprintf(*a, "-");
+        if (x == CUE_UNSET) 
+            r = asprintf(a, "-");
         else 
-            sprintf(*a, "%lf", q->position[n]);
+            r = asprintf(a, "%lf", x);
+
+        if (r == -1) {
+            perror("asprintf");
+            *a = NULL;
+            cues_string_free(p);
+            return NULL;
+        }
 
         a++;
     }
     *a = NULL;
-    return 0;
+    return p;
 }
 
 static int cues_init(struct cues *q, const char *cueloader, const char *path, const char *cmd)
 {
     pid_t pid;
-    char *p[30];
-    int r;
+    char **p;
 
     if (q->pid != 0)
         return -1;
 
     fprintf(stderr, "%sing cues for '%s'...\n", cmd, path);
 
-    r = cues_string(q, p, path, cmd);
-    if (r == -1)
+    p = cues_string(q, path, cmd);
+    if (p == NULL)
         return -1;
 
     pid = fork_pipe_nb_ar(&q->fd, cueloader, p);
@@ -190,6 +347,11 @@ static int cues_init(struct cues *q, const char *cueloader, const char *path, co
 
 int cues_set_by_cueloader(struct cues *q, const char *cueloader, const char *path)
 {
+    if (q->pid != 0)
+        return -1;
+
+    q->markers = 0; /* the cueloader gives them all, if any */
+
     return cues_init(q, cueloader, path, "LOAD");
 }
 
@@ -239,9 +401,6 @@ static int read_from_pipe(struct cues *q)
         ssize_t z;
         double p;
 
-        if (q->index >= MAX_CUES) 
-            return -1; /* stop loading anything when all cues set */
-
         z = get_line(q->fd, &q->rb, &line);
         if (z == -1) {
             if (errno == EAGAIN)
@@ -261,6 +420,16 @@ static int read_from_pipe(struct cues *q)
             q->index++;
             continue; 
         }
+
+        /* Beyond the labelled cue points, each is added to the
+         * others */
+
+        if (q->index >= MAX_CUES) {
+            if (p != CUE_UNSET && cues_add(q, p) == -1)
+                return -1;
+            q->index++;
+            continue;
+        }
         
         q->position[q->index] = p;
         debug("cue[%d] = %lf", q->index, q->position[q->index]);
@@ -269,6 +438,87 @@ static int read_from_pipe(struct cues *q)
     }
 }
 
+/*
+ * Import the audio at the first cue point ahead of the rest of the
+ * track, so that it can be played sooner
+ */
+
+static void import_ahead(struct cues *q)
+{
+    unsigned int n;
+
+    for (n = 0; n < MAX_CUES; n++) {
+        if (q->position[n] != CUE_UNSET) {
+            track_import_ahead(q->deck->player.track, q->position[n]);
+            return;
+        }
+    }
+}
+
+/*
+ * Set the cue points from those kept for the given track, replacing
+ * any which are set
+ *
+ * Return: true if the store has cue points for the track, otherwise
+ * false and no cue points are set
+ * Pre: the track is loaded in the deck
+ */
+
+bool cues_load_from_store(struct cues *q, const char *path)
+{
+    size_t n, ncues;
+    double *p;
+
+    cues_unset_all(q);
+
+    ncues = store_get(&cues_store, path, q->position, MAX_CUES);
+
+    if (ncues > MAX_CUES) {
+        p = malloc(sizeof *p * ncues);
+        if (p == NULL) {
+            perror("malloc");
+        } else {
+            ncues = store_get(&cues_store, path, p, ncues);
+            for (n = MAX_CUES; n < ncues; n++) {
+                if (cues_add(q, p[n]) == -1)
+                    break;
+            }
+            free(p);
+        }
+    }
+
+    controller_update(q->deck);
+    import_ahead(q);
+
+    return ncues > 0;
+}
+
+/*
+ * Keep the cue points for the given track
+ */
+
+void cues_save_to_store(const struct cues *q, const char *path)
+{
+    double *p;
+
+    if (q->markers == 0) {
+        store_put(&cues_store, path, q->position, MAX_CUES);
+        return;
+    }
+
+    p = malloc(sizeof *p * (MAX_CUES + q->markers));
+    if (p == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    memcpy(p, q->position, sizeof *p * MAX_CUES);
+    memcpy(p + MAX_CUES, q->marker, sizeof *p * q->markers);
+    store_put(&cues_store, path, p, MAX_CUES + q->markers);
+
+    free(p);
+}
+
 static void do_wait(struct cues *q)
 {
     int status;
@@ -287,6 +537,7 @@ static void do_wait(struct cues *q)
     if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
         fprintf(stderr, "Cue loading/saving completed\n");
         controller_update(q->deck);
+        import_ahead(q);
     } else {
         fprintf(stderr, "Cue loading/saving completed with status %d\n", status);
         if (!q->terminated)
@@ -307,7 +558,7 @@ static void terminate(struct cues *q)
     q->terminated = true;
 }
 
-static void cues_clear(struct cues *q)
+static void loader_clear(struct cues *q)
 {
     assert(q->pid == 0);
     list_del(&q->cuess);
@@ -328,7 +579,7 @@ void cues_release(struct cues *q)
     }
 
     if (q->refcount == 0) {
-        cues_clear(q);
+        loader_clear(q);
     }
 }
 
@@ -21,16 +21,23 @@
 #define CUES_H
 
 #include <math.h>
+#include <stdbool.h>
 
 #include "external.h"
 #include "list.h"
 #include "library.h"
+#include "store.h"
 
 #define MAX_CUES 16
 #define CUE_UNSET (HUGE_VAL)
 
 /*
  * A set of cue points
+ *
+ * The labelled cue points are in a table of their own, which can be
+ * changed from the realtime thread. Any number of further cue points,
+ * such as the boundaries of the tracks in a recorded mix, are kept in
+ * order; these are changed only with the rig lock held.
  */
 
 struct cues {
@@ -40,6 +47,9 @@ struct cues {
 
     double position[MAX_CUES];
 
+    double *marker;
+    size_t markers, size;
+
     struct event completion;
    /* State of cues loading */
 
@@ -55,15 +65,23 @@ struct cues {
     struct rb rb;
 };
 
+extern struct store cues_store;
+
 void cues_reset(struct cues *q);
+void cues_clear(struct cues *q);
+void cues_unset_all(struct cues *q);
 
 void cues_unset(struct cues *q, unsigned int label);
 void cues_set(struct cues *q, unsigned int label, double position);
 double cues_get(const struct cues *q, unsigned int label);
 double cues_prev(const struct cues *q, double current);
 double cues_next(const struct cues *q, double current);
+size_t cues_count(const struct cues *q, double from, double to);
+int cues_add(struct cues *q, double position);
 int cues_set_by_cueloader(struct cues *q, const char *cueloader, const char *path);
 int cues_save_by_cueloader(struct cues *q, const char *cueloader, const char *path);
+bool cues_load_from_store(struct cues *q, const char *path);
+void cues_save_to_store(const struct cues *q, const char *path);
 void cues_acquire(struct cues *q);
 void cues_pollfd(struct cues *q, struct pollfd *pe);
 void cues_handle(struct cues *q);
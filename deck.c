@@ -19,6 +19,7 @@
 
 #include <assert.h>
 
+#include "beat.h"
 #include "controller.h"
 #include "cues.h"
 #include "deck.h"
@@ -41,12 +42,16 @@ static const struct record no_record = {
  * A deck is a logical grouping of the various components which
  * reflects the user's view on a deck in the system.
  *
+ * Cue points are kept in the built-in store if cue_store is set, and
+ * the cueloader is used only for a track the store has none for.
+ * Otherwise the cueloader is used for all of them.
+ *
  * Pre: deck->device is valid
  */
 
 int deck_init(struct deck *d, struct rt *rt,
               struct timecode_def *timecode, 
-              const char *importer, const char *cueloader,
+              const char *importer, const char *cueloader, bool cue_store,
               double speed, bool phono, bool protect)
 {
     unsigned int rate;
@@ -60,7 +65,9 @@ int deck_init(struct deck *d, struct rt *rt,
     d->protect = protect;
     assert(importer != NULL);
     d->importer = importer;
+    assert(cueloader != NULL);
     d->cueloader = cueloader;
+    d->cue_store = cue_store;
     rate = device_sample_rate(&d->device);
     assert(timecode != NULL);
     timecoder_init(&d->timecoder, timecode, speed, rate, phono);
@@ -81,6 +88,7 @@ void deck_clear(struct deck *d)
 {
     /* FIXME: remove from rig and rt */
     player_clear(&d->player);
+    cues_clear(&d->cues);
     timecoder_clear(&d->timecoder);
     device_clear(&d->device);
 }
@@ -103,14 +111,24 @@ void deck_load(struct deck *d, struct record *record)
         return;
     }
 
-    t = track_acquire_by_import(d->importer, record->pathname);
+    t = track_acquire_by_import(d->importer, record->pathname,
+                                device_sample_rate(&d->device));
     if (t == NULL)
         return;
 
-    cues_set_by_cueloader(&d->cues, d->cueloader, record->pathname);
+    beat_request(record, t);
+
+    if (!d->cue_store)
+        cues_set_by_cueloader(&d->cues, d->cueloader, record->pathname);
 
     d->record = record;
     player_set_track(&d->player, t); /* passes reference */
+
+    /* Fall back to the cueloader for a track which has not been
+     * seen since the store was used, such as one with a .cue file */
+
+    if (d->cue_store && !cues_load_from_store(&d->cues, record->pathname))
+        cues_set_by_cueloader(&d->cues, d->cueloader, record->pathname);
 }
 
 void deck_recue(struct deck *d)
@@ -157,8 +175,10 @@ void deck_cue(struct deck *d, unsigned int label)
         cues_set(&d->cues, label, player_get_elapsed(&d->player));
         controller_update(d);
     }
-    else
+    else {
+        player_import_ahead(&d->player, p);
         player_seek_to(&d->player, p);
+    }
 
 }
 
@@ -182,6 +202,7 @@ void deck_punch_in(struct deck *d, unsigned int label)
     if (d->punch != NO_PUNCH)
         e -= d->punch;
 
+    player_import_ahead(&d->player, p);
     player_seek_to(&d->player, p);
     d->punch = p - e;
 }
@@ -204,8 +225,15 @@ void deck_punch_out(struct deck *d)
 
 void deck_save_cue(struct deck *d)
 {
-    if (d->record->pathname)
+    if (!d->record->pathname)
+        return;
+
+    if (d->cue_store) {
+        cues_save_to_store(&d->cues, d->record->pathname);
+        status_printf(STATUS_INFO, "Saved cue points");
+    } else {
         cues_save_by_cueloader(&d->cues, 
                                d->cueloader, 
                                d->record->pathname);
+    }
 }
@@ -35,7 +35,7 @@ struct deck {
     struct device device;
     struct timecoder timecoder;
     const char *importer, *cueloader;
-    bool protect;
+    bool cue_store, protect;
 
     struct player player;
     const struct record *record;
@@ -53,7 +53,7 @@ struct deck {
 
 int deck_init(struct deck *deck, struct rt *rt,
               struct timecode_def *timecode, 
-              const char *importer, const char *cueloader,
+              const char *importer, const char *cueloader, bool cue_store,
               double speed, bool phono, bool protect);
 void deck_clear(struct deck *deck);
 
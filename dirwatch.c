@@ -0,0 +1,477 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Watch a directory tree for changes, using inotify
+ *
+ * Changes are gathered up and notified once for each time the rig
+ * wakes us, so that the receiver can act on them together.
+ */
+
+#define _GNU_SOURCE /* strdupa(), DT_DIR etc. */
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "debug.h"
+#include "dirwatch.h"
+#include "rig.h"
+
+#define MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE \
+              | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+static void paths_init(struct paths *p)
+{
+    p->path = NULL;
+    p->entries = 0;
+    p->size = 0;
+}
+
+static void paths_blank(struct paths *p)
+{
+    size_t n;
+
+    for (n = 0; n < p->entries; n++)
+        free(p->path[n]);
+
+    p->entries = 0;
+}
+
+static void paths_clear(struct paths *p)
+{
+    paths_blank(p);
+    free(p->path);
+}
+
+/*
+ * Add a copy of the given pathname
+ *
+ * Return: 0 on success or -1 on memory allocation failure
+ */
+
+static int paths_add(struct paths *p, const char *path)
+{
+    char *s;
+
+    if (p->entries == p->size) {
+        char **x;
+        size_t size;
+
+        size = p->size * 2 + 16;
+        x = realloc(p->path, sizeof(char*) * size);
+        if (x == NULL) {
+            perror("realloc");
+            return -1;
+        }
+
+        p->path = x;
+        p->size = size;
+    }
+
+    s = strdup(path);
+    if (s == NULL) {
+        perror("strdup");
+        return -1;
+    }
+
+    p->path[p->entries++] = s;
+    return 0;
+}
+
+/*
+ * Return: pathname of an entry in the given directory, or NULL on
+ * memory allocation failure
+ */
+
+static char* join(const char *dir, const char *name)
+{
+    char *s;
+
+    s = malloc(strlen(dir) + strlen(name) + 2);
+    if (s == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    sprintf(s, "%s/%s", dir, name);
+    return s;
+}
+
+/*
+ * Return: true if the path is the given directory or within it
+ */
+
+bool path_is_within(const char *path, const char *dir)
+{
+    size_t len;
+
+    len = strlen(dir);
+
+    if (strncmp(path, dir, len) != 0)
+        return false;
+
+    return path[len] == '\0' || path[len] == '/';
+}
+
+/*
+ * Record the pathname of a watched directory
+ *
+ * Return: 0 on success or -1 on memory allocation failure
+ */
+
+static int set_dir(struct dirwatch *w, int wd, const char *path)
+{
+    char *s;
+
+    assert(wd >= 0);
+
+    if (wd >= w->dirs) {
+        char **x;
+        size_t n;
+
+        x = realloc(w->dir, sizeof(char*) * (wd + 1));
+        if (x == NULL) {
+            perror("realloc");
+            return -1;
+        }
+
+        for (n = w->dirs; n <= wd; n++)
+            x[n] = NULL;
+
+        w->dir = x;
+        w->dirs = wd + 1;
+    }
+
+    s = strdup(path);
+    if (s == NULL) {
+        perror("strdup");
+        return -1;
+    }
+
+    free(w->dir[wd]);
+    w->dir[wd] = s;
+
+    return 0;
+}
+
+static void forget_dir(struct dirwatch *w, int wd)
+{
+    if (wd < 0 || wd >= w->dirs)
+        return;
+
+    free(w->dir[wd]);
+    w->dir[wd] = NULL;
+}
+
+/*
+ * Watch a directory and, recursively, the directories within it
+ *
+ * Errors are reported, but we carry on and watch as much of the tree
+ * as we can.
+ *
+ * Return: -1 if no more watches can be added, otherwise 0
+ */
+
+static int add_tree(struct dirwatch *w, const char *path)
+{
+    int wd, r;
+    DIR *d;
+    struct dirent *e;
+
+    wd = inotify_add_watch(w->fd, path, MASK);
+    if (wd == -1) {
+        switch (errno) {
+        case ENOTDIR: /* symlink to a file */
+        case ENOENT: /* already gone */
+            return 0;
+        case ENOSPC:
+            fprintf(stderr, "Not all of %s can be watched for changes; "
+                    "see fs.inotify.max_user_watches\n", path);
+            return -1;
+        default:
+            perror(path);
+            return 0;
+        }
+    }
+
+    /* Don't follow symlinks around in a loop */
+
+    if (wd < w->dirs && w->dir[wd] != NULL)
+        return 0;
+
+    if (set_dir(w, wd, path) == -1)
+        return 0;
+
+    debug("watching %s as %d", path, wd);
+
+    d = opendir(path);
+    if (d == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    r = 0;
+
+    while ((e = readdir(d)) != NULL) {
+        char *sub;
+
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+
+        if (e->d_type != DT_DIR && e->d_type != DT_LNK
+            && e->d_type != DT_UNKNOWN)
+        {
+            continue;
+        }
+
+        sub = join(path, e->d_name);
+        if (sub == NULL)
+            break;
+
+        r = add_tree(w, sub);
+        free(sub);
+
+        if (r == -1)
+            break;
+    }
+
+    if (closedir(d) == -1)
+        abort();
+
+    return r;
+}
+
+/*
+ * Stop watching a directory which has moved away, and everything
+ * within it
+ */
+
+static void remove_tree(struct dirwatch *w, const char *path)
+{
+    size_t wd;
+
+    for (wd = 0; wd < w->dirs; wd++) {
+        if (w->dir[wd] == NULL || !path_is_within(w->dir[wd], path))
+            continue;
+
+        (void)inotify_rm_watch(w->fd, wd); /* may already be gone */
+        forget_dir(w, wd);
+    }
+}
+
+/*
+ * Return: -1 if changes have been lost, otherwise 0
+ */
+
+static int handle_event(struct dirwatch *w, const struct inotify_event *ev)
+{
+    int r;
+    char *path;
+
+    if (ev->mask & IN_Q_OVERFLOW)
+        return -1;
+
+    if (ev->mask & IN_IGNORED) {
+        forget_dir(w, ev->wd);
+        return 0;
+    }
+
+    if (ev->wd < 0 || ev->wd >= w->dirs || w->dir[ev->wd] == NULL)
+        return 0;
+
+    if (ev->len == 0) /* about the directory itself */
+        return 0;
+
+    path = join(w->dir[ev->wd], ev->name);
+    if (path == NULL)
+        return -1;
+
+    debug("event 0x%x on %s", ev->mask, path);
+
+    r = 0;
+
+    if (ev->mask & IN_ISDIR) {
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+            (void)add_tree(w, path);
+            r = paths_add(&w->subdirs, path);
+        } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            remove_tree(w, path);
+            r = paths_add(&w->removed, path);
+        }
+    } else {
+        /* A new file is not complete until it is closed */
+
+        if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+            r = paths_add(&w->files, path);
+        else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+            r = paths_add(&w->removed, path);
+    }
+
+    free(path);
+    return r;
+}
+
+/*
+ * Start watching the directory tree at the given path
+ *
+ * Return: 0 on success or -1 on error
+ */
+
+int dirwatch_init(struct dirwatch *w, const char *path)
+{
+    char *top;
+    size_t len;
+
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd == -1) {
+        perror("inotify_init1");
+        return -1;
+    }
+
+    w->pe = NULL;
+    w->dir = NULL;
+    w->dirs = 0;
+
+    paths_init(&w->files);
+    paths_init(&w->subdirs);
+    paths_init(&w->removed);
+
+    /* Pathnames must be in the same form as given by the scan,
+     * which is without a trailing slash */
+
+    top = strdupa(path);
+    len = strlen(top);
+    while (len > 1 && top[len - 1] == '/')
+        top[--len] = '\0';
+
+    (void)add_tree(w, top);
+
+    if (w->dirs == 0) { /* not even the top level */
+        if (close(w->fd) == -1)
+            abort();
+        return -1;
+    }
+
+    event_init(&w->change);
+    event_init(&w->overflow);
+
+    rig_post_dirwatch(w);
+
+    return 0;
+}
+
+/*
+ * Pre: rig is not running, or its lock is held
+ */
+
+void dirwatch_clear(struct dirwatch *w)
+{
+    size_t n;
+
+    list_del(&w->rig);
+
+    if (close(w->fd) == -1)
+        abort();
+
+    for (n = 0; n < w->dirs; n++)
+        free(w->dir[n]);
+    free(w->dir);
+
+    paths_clear(&w->files);
+    paths_clear(&w->subdirs);
+    paths_clear(&w->removed);
+
+    event_clear(&w->change);
+    event_clear(&w->overflow);
+}
+
+/*
+ * Get entry for use by poll()
+ *
+ * Post: *pe contains poll entry
+ */
+
+void dirwatch_pollfd(struct dirwatch *w, struct pollfd *pe)
+{
+    pe->fd = w->fd;
+    pe->events = POLLIN;
+
+    w->pe = pe;
+}
+
+/*
+ * Read the changes and notify them
+ */
+
+void dirwatch_handle(struct dirwatch *w)
+{
+    bool lost;
+
+    if (w->pe == NULL)
+        return;
+
+    if (w->pe->revents == 0)
+        return;
+
+    lost = false;
+
+    for (;;) {
+        char buf[4096]
+            __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        const char *p;
+        ssize_t z;
+
+        z = read(w->fd, buf, sizeof buf);
+        if (z == -1) {
+            if (errno == EAGAIN)
+                break;
+            perror("read");
+            lost = true;
+            break;
+        }
+
+        for (p = buf; p < buf + z;) {
+            const struct inotify_event *ev;
+
+            ev = (const struct inotify_event*)p;
+            p += sizeof *ev + ev->len;
+
+            if (handle_event(w, ev) == -1)
+                lost = true;
+        }
+    }
+
+    if (lost) {
+        fprintf(stderr, "Changes to the library were lost\n");
+        fire(&w->overflow, NULL);
+    } else if (w->files.entries > 0 || w->subdirs.entries > 0
+               || w->removed.entries > 0)
+    {
+        fire(&w->change, w);
+    }
+
+    paths_blank(&w->files);
+    paths_blank(&w->subdirs);
+    paths_blank(&w->removed);
+}
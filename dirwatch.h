@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DIRWATCH_H
+#define DIRWATCH_H
+
+#include <stdbool.h>
+#include <sys/poll.h>
+
+#include "list.h"
+#include "observer.h"
+
+/* A list of pathnames, each a separate malloc */
+
+struct paths {
+    char **path;
+    size_t entries, size;
+};
+
+struct dirwatch {
+    struct list rig;
+    int fd;
+    struct pollfd *pe;
+
+    /* Pathname of each directory, by its watch descriptor */
+
+    char **dir;
+    size_t dirs;
+
+    /* Changes since the last notification */
+
+    struct paths files, /* new or re-written */
+        subdirs, /* new, and the files in them */
+        removed; /* files or directories */
+
+    struct event change, /* after some of the above */
+        overflow; /* changes were lost */
+};
+
+int dirwatch_init(struct dirwatch *w, const char *path);
+void dirwatch_clear(struct dirwatch *w);
+
+bool path_is_within(const char *path, const char *dir);
+
+/* Used by the rig */
+
+void dirwatch_pollfd(struct dirwatch *w, struct pollfd *pe);
+void dirwatch_handle(struct dirwatch *w);
+
+#endif
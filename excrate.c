@@ -30,6 +30,7 @@
 #include <stdlib.h>
 #include <sys/wait.h>
 
+#include "beat.h"
 #include "debug.h"
 #include "excrate.h"
 #include "rig.h"
@@ -189,6 +190,7 @@ static int read_from_pipe(struct excrate *e)
         char *line;
         ssize_t z;
         struct record *d, *x;
+        struct beat b;
 
         z = get_line(e->fd, &e->rb, &line);
         if (z == -1) {
@@ -209,6 +211,12 @@ static int read_from_pipe(struct excrate *e)
             continue; /* ignore malformed entries */
         }
 
+        /* Use the tempo from an earlier analysis, if the scan has
+         * none */
+
+        if (d->bpm == 0.0 && beat_get(d->pathname, &b))
+            d->bpm = b.bpm;
+
         x = listing_add(e->storage, d);
         if (x == NULL)
             return -1;
@@ -17,14 +17,18 @@
  *
  */
 
-#define _DEFAULT_SOURCE /* vfork() */
+#define _GNU_SOURCE /* vfork(), sched_setaffinity() */
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 
 #include "debug.h"
@@ -32,14 +36,28 @@
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
 
+/* Priority of processes in the background; there is no header for
+ * the disk priority in the C library */
+
+#define BACKGROUND_NICE 10
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_SHIFT 13
+#define BACKGROUND_IOPRIO ((IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7)
+
+static int avoid_cpu = -1;
+
 /*
- * Fork a child process, attaching stdout to the given pipe
+ * Fork a child process, attaching stdout to the given pipe, and
+ * optionally stdin too
  *
  * Return: -1 on error, or pid on success
  * Post: on success, *fd is file handle for reading
  */
 
-static pid_t do_fork(int pp[2], const char *path, char *argv[])
+static pid_t do_fork(int pp[2], const char *path, char *argv[],
+                     bool duplex)
 {
     pid_t pid;
 
@@ -58,6 +76,11 @@ static pid_t do_fork(int pp[2], const char *path, char *argv[])
             _exit(EXIT_FAILURE); /* vfork() was used */
         }
 
+        if (duplex && dup2(pp[1], STDIN_FILENO) == -1) {
+            perror("dup2");
+            _exit(EXIT_FAILURE); /* vfork() was used */
+        }
+
         if (close(pp[1]) != 0)
             abort();
 
@@ -84,7 +107,8 @@ static pid_t do_fork(int pp[2], const char *path, char *argv[])
  * forked.
  */
 
-static pid_t vext(int pp[2], const char *path, char *arg, va_list ap)
+static pid_t vext(int pp[2], const char *path, char *arg, va_list ap,
+                  bool duplex)
 {
     char *args[16];
     size_t n;
@@ -105,7 +129,7 @@ static pid_t vext(int pp[2], const char *path, char *arg, va_list ap)
             break;
     }
 
-    return do_fork(pp, path, args);
+    return do_fork(pp, path, args, duplex);
 }
 
 /*
@@ -128,7 +152,7 @@ pid_t fork_pipe(int *fd, const char *path, char *arg, ...)
     }
 
     va_start(va, arg);
-    r = vext(pp, path, arg, va);
+    r = vext(pp, path, arg, va, false);
     va_end(va);
 
     if (r == -1) {
@@ -182,7 +206,7 @@ pid_t fork_pipe_nb(int *fd, const char *path, char *arg, ...)
         goto fail;
 
     va_start(va, arg);
-    r = vext(pp, path, arg, va);
+    r = vext(pp, path, arg, va, false);
     va_end(va);
 
     assert(r != 0);
@@ -214,7 +238,7 @@ pid_t fork_pipe_nb_ar(int *fd, const char *path, char *arg[])
     if (make_non_blocking(pp[0]) == -1)
         goto fail;
 
-    r = do_fork(pp, path, arg);
+    r = do_fork(pp, path, arg, false);
 
     assert(r != 0);
     if (r < 0)
@@ -232,6 +256,90 @@ fail:
     return -1;
 }
 
+/*
+ * Fork a child process with stdin and stdout connected to this
+ * process via a socket, for a conversation in both directions
+ *
+ * Return: PID on success, otherwise -1
+ * Post: on success, *fd is blocking socket for reading and writing
+ */
+
+pid_t fork_socket(int *fd, const char *path, char *arg, ...)
+{
+    int sv[2];
+    pid_t r;
+    va_list va;
+
+    /* Other children must not keep our end of the socket open */
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("socketpair");
+        return -1;
+    }
+
+    va_start(va, arg);
+    r = vext(sv, path, arg, va, true);
+    va_end(va);
+
+    assert(r != 0);
+    if (r < 0) {
+        if (close(sv[0]) != 0)
+            abort();
+        if (close(sv[1]) != 0)
+            abort();
+        return -1;
+    }
+
+    *fd = sv[0];
+    return r;
+}
+
+/*
+ * Request that processes in the background are kept off the given
+ * CPU, eg. the one the realtime thread is bound to
+ */
+
+void background_avoid_cpu(int cpu)
+{
+    avoid_cpu = cpu;
+}
+
+/*
+ * Lower the priority of a child process, for both the CPU and the
+ * disk, so that it competes less with what the user is doing
+ *
+ * Failure is not fatal; the process continues as it is.
+ */
+
+void make_background(pid_t pid)
+{
+    if (setpriority(PRIO_PROCESS, pid, BACKGROUND_NICE) == -1)
+        perror("setpriority");
+
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid,
+                BACKGROUND_IOPRIO) == -1)
+    {
+        perror("ioprio_set");
+    }
+
+    if (avoid_cpu != -1) {
+        cpu_set_t set;
+
+        if (sched_getaffinity(pid, sizeof set, &set) == -1) {
+            perror("sched_getaffinity");
+            return;
+        }
+
+        CPU_CLR(avoid_cpu, &set);
+
+        if (CPU_COUNT(&set) > 0
+            && sched_setaffinity(pid, sizeof set, &set) == -1)
+        {
+            perror("sched_setaffinity");
+        }
+    }
+}
+
 void rb_reset(struct rb *rb)
 {
     rb->len = 0;
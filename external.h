@@ -40,6 +40,10 @@ struct rb {
 pid_t fork_pipe(int *fd, const char *path, char *arg, ...);
 pid_t fork_pipe_nb(int *fd, const char *path, char *arg, ...);
 pid_t fork_pipe_nb_ar(int *fd, const char *path, char *arg[]);
+pid_t fork_socket(int *fd, const char *path, char *arg, ...);
+
+void background_avoid_cpu(int cpu);
+void make_background(pid_t pid);
 
 void rb_reset(struct rb *rb);
 ssize_t get_line(int fd, struct rb *rb, char **string);
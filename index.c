@@ -264,6 +264,24 @@ void match_compile(struct match *h, const char *d)
     h->words[n] = NULL; /* terminate list */
 }
 
+/*
+ * Copy a compiled search
+ *
+ * The compiled words point into the buffer, so a plain structure
+ * copy is not enough.
+ */
+
+void match_copy(struct match *dest, const struct match *src)
+{
+    size_t n;
+
+    memcpy(dest->buf, src->buf, sizeof dest->buf);
+
+    for (n = 0; src->words[n] != NULL; n++)
+        dest->words[n] = dest->buf + (src->words[n] - src->buf);
+    dest->words[n] = NULL;
+}
+
 /*
  * Find entries from the source index which match
  *
@@ -295,6 +313,126 @@ int index_match(struct index *src, struct index *dest,
     return 0;
 }
 
+/*
+ * Compile the range of tempo which is compatible with the given BPM,
+ * within a tolerance given as a fraction of the BPM
+ *
+ * Double and half time are also compatible. Overlapping ranges are
+ * joined, so that no record is in more than one.
+ *
+ * Pre: bpm is greater than zero
+ * Pre: tolerance is at least zero, and less than one
+ */
+
+void tempo_compile(struct tempo *t, double bpm, double tolerance)
+{
+    static const double factor[] = { 2.0, 1.0, 0.5 }; /* fastest first */
+    size_t n;
+
+    assert(bpm > 0.0);
+    assert(tolerance >= 0.0 && tolerance < 1.0);
+
+    t->ranges = 0;
+
+    for (n = 0; n < ARRAY_SIZE(factor); n++) {
+        double low, high;
+
+        low = bpm * factor[n] * (1.0 - tolerance);
+        high = bpm * factor[n] * (1.0 + tolerance);
+
+        if (t->ranges > 0 && high >= t->range[t->ranges - 1].low) {
+            t->range[t->ranges - 1].low = low;
+            continue;
+        }
+
+        t->range[t->ranges].low = low;
+        t->range[t->ranges].high = high;
+        t->ranges++;
+    }
+}
+
+/*
+ * Return: true if the record is of a compatible tempo, otherwise false
+ */
+
+bool record_tempo(const struct record *re, const struct tempo *t)
+{
+    size_t n;
+
+    for (n = 0; n < t->ranges; n++) {
+        if (re->bpm >= t->range[n].low && re->bpm <= t->range[n].high)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Return: position of the first record which is no faster than the
+ * given BPM
+ * Pre: index is sorted by SORT_BPM
+ */
+
+static size_t bpm_search(const struct index *ls, double bpm)
+{
+    size_t low, high;
+
+    low = 0;
+    high = ls->entries;
+
+    while (low < high) {
+        size_t mid;
+
+        mid = low + (high - low) / 2;
+        if (ls->record[mid]->bpm > bpm)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/*
+ * Find entries from the source index which are of a compatible tempo
+ * and also match
+ *
+ * The start of each range of tempo is found by binary search, so the
+ * cost is in the number of records in range, not the whole index.
+ * The destination is in the same order as the source.
+ *
+ * Pre: src is sorted by SORT_BPM
+ * Return: 0 on success, or -1 on memory allocation failure
+ * Post: on failure, dest is valid but incomplete
+ */
+
+int index_match_tempo(struct index *src, struct index *dest,
+                      const struct tempo *t, const struct match *match)
+{
+    size_t r, n;
+
+    index_blank(dest);
+
+    for (r = 0; r < t->ranges; r++) {
+        for (n = bpm_search(src, t->range[r].high); n < src->entries; n++) {
+            struct record *re;
+
+            re = src->record[n];
+            if (re->bpm < t->range[r].low)
+                break;
+
+            if (!record_match(re, match))
+                continue;
+
+            if (index_reserve(dest, 1) == -1)
+                return -1;
+            index_add(dest, re);
+        }
+    }
+
+    return 0;
+}
+
 /*
  * Binary search of sorted index
  *
@@ -377,6 +515,38 @@ struct record* index_insert(struct index *ls, struct record *item,
     return item;
 }
 
+/*
+ * Remove an entry from the index, if it is present
+ *
+ * Pre: index is sorted, unless sort is SORT_PLAYLIST
+ * Return: true if the item was removed, otherwise false
+ */
+
+bool index_remove(struct index *ls, struct record *item, int sort)
+{
+    bool found;
+    size_t z;
+
+    if (sort == SORT_PLAYLIST) {
+        for (z = 0; z < ls->entries; z++) {
+            if (ls->record[z] == item)
+                break;
+        }
+        found = (z < ls->entries);
+    } else {
+        z = bin_search(ls->record, ls->entries, item, sort, &found);
+    }
+
+    if (!found || ls->record[z] != item)
+        return false;
+
+    ls->entries--;
+    memmove(ls->record + z, ls->record + z + 1,
+            sizeof(struct record*) * (ls->entries - z));
+
+    return true;
+}
+
 /*
  * Reserve space in the index for the addition of n new items
  *
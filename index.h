@@ -55,6 +55,15 @@ struct match {
     char *words[32]; /* NULL-terminated array */
 };
 
+/* A 'compiled' range of tempo, fastest first */
+
+struct tempo {
+    size_t ranges;
+    struct {
+        double low, high; /* BPM, inclusive */
+    } range[3];
+};
+
 void index_init(struct index *ls);
 void index_clear(struct index *ls);
 void index_blank(struct index *ls);
@@ -62,10 +71,16 @@ void index_add(struct index *li, struct record *lr);
 bool record_match(struct record *re, const struct match *h);
 int index_copy(const struct index *src, struct index *dest);
 void match_compile(struct match *h, const char *d);
+void match_copy(struct match *dest, const struct match *src);
 int index_match(struct index *src, struct index *dest,
                 const struct match *match);
+void tempo_compile(struct tempo *t, double bpm, double tolerance);
+bool record_tempo(const struct record *re, const struct tempo *t);
+int index_match_tempo(struct index *src, struct index *dest,
+                      const struct tempo *t, const struct match *match);
 struct record* index_insert(struct index *ls, struct record *item,
                             int sort);
+bool index_remove(struct index *ls, struct record *item, int sort);
 int index_reserve(struct index *i, unsigned int n);
 size_t index_find(struct index *ls, struct record *item, int sort);
 void index_debug(struct index *ls);
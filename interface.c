@@ -20,12 +20,15 @@
 #include <assert.h>
 #include <errno.h>
 #include <iconv.h>
+#include <limits.h>
 #include <math.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -35,6 +38,7 @@
 
 #include "interface.h"
 #include "layout.h"
+#include "list.h"
 #include "player.h"
 #include "rig.h"
 #include "selector.h"
@@ -42,9 +46,11 @@
 #include "timecoder.h"
 #include "xwax.h"
 
-/* Screen refresh time in milliseconds */
+/* Screen refresh time in milliseconds, when the decks are moving
+ * and when they are not */
 
 #define REFRESH 10
+#define IDLE_REFRESH 50
 
 /* Font definitions */
 
@@ -90,6 +96,8 @@
 
 #define PLAYER_HEIGHT 213
 #define OVERVIEW_HEIGHT 16
+#define OVERVIEW_MARKERS 1024 /* divisions of the track to count cue points */
+#define MARKER_HEIGHT 4
 
 #define LIBRARY_MIN_WIDTH 64
 #define LIBRARY_MIN_HEIGHT 64
@@ -116,6 +124,8 @@
 
 #define METER_WARNING_TIME 20 /* time in seconds for "red waveform" warning */
 
+#define TEMPO_TOLERANCE 0.06 /* fraction of BPM for compatible tempo */
+
 /* Function key (F1-F12) definitions */
 
 #define FUNC_LOAD 0
@@ -129,10 +139,12 @@
 #define EVENT_QUIT   (SDL_USEREVENT + 1)
 #define EVENT_STATUS (SDL_USEREVENT + 2)
 #define EVENT_SELECTOR (SDL_USEREVENT + 3)
+#define EVENT_SEARCH (SDL_USEREVENT + 4)
 
 /* Macro functions */
 
 #define MIN(x,y) ((x)<(y)?(x):(y))
+#define MAX(x,y) ((x)>(y)?(x):(y))
 #define SQ(x) ((x)*(x))
 
 #define LOCK(sf) if (SDL_MUSTLOCK(sf)) SDL_LockSurface(sf)
@@ -166,9 +178,21 @@ static SDL_Color background_col = {0, 0, 0, 255},
     detail_col = {128, 128, 128, 255},
     needle_col = {255, 255, 255, 255},
     artist_col = {16, 64, 0, 255},
-    bpm_col = {64, 16, 0, 255};
+    bpm_col = {64, 16, 0, 255},
+    marker_col = {255, 192, 0, 255};
+
+/* The spinner is pre-rendered at a number of angles, in the normal
+ * and alert colours */
+
+#define SPINNER_FRAMES 256
+
+static SDL_Surface *spinner_frame[2][SPINNER_FRAMES];
 
-static unsigned short *spinner_angle, spinner_size;
+/* Colour of the waveform, by the meters of each frequency band */
+
+#define BAND_BITS 4
+
+static SDL_Color band_lut[1 << (BAND_BITS * BANDS)];
 
 static int width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT,
     meter_scale = DEFAULT_METER_SCALE;
@@ -177,7 +201,120 @@ static float scale = DEFAULT_SCALE;
 static iconv_t utf;
 static pthread_t ph;
 static struct selector selector;
-static struct observer on_status, on_selector;
+static struct observer on_status, on_selector, on_search;
+
+/* Cache of rendered text, as most text is the same from one redraw
+ * to the next */
+
+#define TEXT_CACHE_SIZE 512 /* entries */
+#define TEXT_CACHE_BUCKETS 1024
+
+struct text {
+    struct list lru; /* most recently used first */
+    struct text *next; /* in the same hash bucket */
+    unsigned int hash;
+    TTF_Font *font; /* or NULL if unused */
+    SDL_Color fg, bg;
+    bool locale;
+    char buf[128];
+    SDL_Surface *surface; /* in the display format, if possible */
+};
+
+static struct text text_cache[TEXT_CACHE_SIZE];
+static struct text *text_bucket[TEXT_CACHE_BUCKETS];
+static struct list text_lru = LIST_INIT(text_lru);
+
+/* The state of each deck as it was last drawn, so that only the
+ * parts which have changed are drawn again */
+
+struct deck_view {
+    bool valid; /* if false, draw everything */
+    bool timecode_control;
+    const struct record *record;
+    int elapse, remain; /* clocks */
+    bool importing;
+    int rangle; /* spinner frame */
+    bool alert;
+    SDL_Surface *scope; /* of the monitor, or NULL */
+    char status[128];
+    const struct track *track; /* meters */
+    unsigned int length, hole;
+    int needle, closeup, scale;
+    bool warning, meters_importing;
+    SDL_Surface *overview[2]; /* unplayed and played, or NULL */
+};
+
+static struct deck_view *view; /* one per deck */
+
+/* A copy of the state to be drawn, taken whilst the rig is locked,
+ * so that the drawing itself does not hold up the rig */
+
+struct deck_snapshot {
+    struct track *track; /* reference is held */
+    const struct record *record;
+    double position, elapsed, remain;
+
+    /* Timecode and player, for the spinner, scope and status */
+
+    const char *timecode;
+    int timecode_position; /* or -1 */
+    double rps, pitch, sync_pitch, last_difference;
+    bool timecode_control, recalibrate, locked,
+        scope_changed; /* since the last snapshot */
+
+    /* Cue points along the track, for the overview */
+
+    unsigned char marker[OVERVIEW_MARKERS]; /* count in each division */
+    bool markers_changed; /* since the last snapshot */
+};
+
+struct crate_row {
+    const char *name;
+    bool is_fixed, is_busy;
+};
+
+struct snapshot {
+    struct deck_snapshot *deck; /* one per deck */
+    bool moving; /* since the last snapshot */
+
+    char status[256];
+    int status_level;
+
+    char search[256];
+    size_t matches;
+    double bpm;
+    int sort;
+    struct listbox crates, records;
+    struct crate_row *crate; /* visible rows only */
+    struct record **record;
+    unsigned int rows, size;
+};
+
+static struct snapshot snapshot;
+
+/* Pacing of the redraws: the time until the next one, and the
+ * share of a CPU which may be spent drawing */
+
+static unsigned int refresh = REFRESH; /* milliseconds */
+static double cpu_share;
+
+static unsigned long frame_count, frame_slowed;
+static double frame_average, frame_total, frame_worst; /* microseconds */
+
+/* Time for which the interface holds the rig lock */
+
+#define LOCK_WARNING 5000 /* microseconds */
+
+static unsigned long lock_count;
+static double lock_total, lock_worst; /* microseconds */
+
+/* Areas of the screen drawn since the last update */
+
+#define MAX_DAMAGE 32
+
+static SDL_Rect damaged[MAX_DAMAGE];
+static int ndamaged;
+static bool damaged_all; /* more than can be listed */
 
 /*
  * Scale a dimension according to the current zoom level
@@ -263,22 +400,96 @@ static void calculate_angle_lut(unsigned short *lut, int size)
     }
 }
 
-static int init_spinner(int size)
+/*
+ * Render one frame of the spinner, as an image with two colours: the
+ * half of the disc behind the given angle is dimmed
+ *
+ * Return: image, or NULL on error
+ */
+
+static SDL_Surface* render_spinner(const unsigned short *lut, int size,
+                                   int rangle, SDL_Color col)
 {
-    spinner_angle = malloc(size * size * (sizeof *spinner_angle));
-    if (spinner_angle == NULL) {
-        perror("malloc");
-        return -1;
+    int r, c;
+    SDL_Surface *sf;
+    SDL_Color palette[2];
+
+    sf = SDL_CreateRGBSurface(SDL_SWSURFACE, size, size, 8, 0, 0, 0, 0);
+    if (sf == NULL) {
+        fprintf(stderr, "%s\n", SDL_GetError());
+        return NULL;
     }
 
-    calculate_angle_lut(spinner_angle, size);
-    spinner_size = size;
-    return 0;
+    palette[0].r = col.r >> 2;
+    palette[0].g = col.g >> 2;
+    palette[0].b = col.b >> 2;
+    palette[1] = col;
+    SDL_SetColors(sf, palette, 0, 2);
+
+    for (r = 0; r < size; r++) {
+        Uint8 *p;
+
+        p = (Uint8*)sf->pixels + r * sf->pitch;
+
+        for (c = 0; c < size; c++) {
+            int pangle;
+
+            pangle = lut[r * size + c];
+            p[c] = ((rangle - pangle + 1024) % 1024 < 512) ? 0 : 1;
+        }
+    }
+
+    return sf;
 }
 
 static void clear_spinner(void)
 {
-    free(spinner_angle);
+    size_t n, f;
+
+    for (n = 0; n < 2; n++) {
+        for (f = 0; f < SPINNER_FRAMES; f++) {
+            if (spinner_frame[n][f] != NULL)
+                SDL_FreeSurface(spinner_frame[n][f]);
+            spinner_frame[n][f] = NULL;
+        }
+    }
+}
+
+/*
+ * Render every frame of the spinner
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int init_spinner(int size)
+{
+    int f;
+    unsigned short *lut;
+
+    lut = malloc(size * size * (sizeof *lut));
+    if (lut == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    calculate_angle_lut(lut, size);
+
+    for (f = 0; f < SPINNER_FRAMES; f++) {
+        int rangle;
+
+        rangle = f * 1024 / SPINNER_FRAMES;
+
+        spinner_frame[0][f] = render_spinner(lut, size, rangle, ok_col);
+        spinner_frame[1][f] = render_spinner(lut, size, rangle, alert_col);
+        if (spinner_frame[0][f] == NULL || spinner_frame[1][f] == NULL) {
+            free(lut);
+            clear_spinner();
+            return -1;
+        }
+    }
+
+    free(lut);
+    return 0;
 }
 
 /*
@@ -392,6 +603,221 @@ static Uint32 palette(SDL_Surface *sf, SDL_Color *col)
     return SDL_MapRGB(sf->format, col->r, col->g, col->b);
 }
 
+/*
+ * Render text to a new surface
+ *
+ * If "locale" is set then a conversion from the system locale is
+ * done.
+ *
+ * Return: surface, or NULL on error
+ */
+
+static SDL_Surface* render_text(const char *buf, TTF_Font *font,
+                                SDL_Color fg, SDL_Color bg, bool locale)
+{
+    char ubuf[256], /* fixed buffer is reasonable for rendering */
+        *in, *out;
+    size_t len, fill;
+
+    if (!locale)
+        return TTF_RenderText_Shaded(font, buf, fg, bg);
+
+    out = ubuf;
+    fill = sizeof(ubuf) - 1; /* always leave space for \0 */
+
+    if (iconv(utf, NULL, NULL, &out, &fill) == -1)
+        abort();
+
+    in = strdupa(buf);
+    len = strlen(in);
+
+    (void)iconv(utf, &in, &len, &out, &fill);
+    *out = '\0';
+
+    return TTF_RenderUTF8_Shaded(font, ubuf, fg, bg);
+}
+
+static bool same_colour(SDL_Color a, SDL_Color b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static unsigned int hash_text(const char *buf, TTF_Font *font,
+                              SDL_Color fg, SDL_Color bg, bool locale)
+{
+    unsigned int h;
+
+    h = 2166136261u; /* FNV-1a */
+    while (*buf != '\0')
+        h = (h ^ (unsigned char)*buf++) * 16777619u;
+
+    h ^= (uintptr_t)font >> 4;
+    h ^= (fg.r << 16 | fg.g << 8 | fg.b) * 31u;
+    h ^= (bg.r << 16 | bg.g << 8 | bg.b) * 131u;
+    h ^= locale;
+
+    return h;
+}
+
+/*
+ * Prepare the cache of rendered text, with every entry unused
+ */
+
+static void text_cache_init(void)
+{
+    size_t n;
+
+    for (n = 0; n < TEXT_CACHE_SIZE; n++) {
+        text_cache[n].font = NULL;
+        text_cache[n].surface = NULL;
+        list_add_tail(&text_cache[n].lru, &text_lru);
+    }
+}
+
+/*
+ * Empty the cache of rendered text
+ *
+ * Post: no surfaces are held in the cache
+ */
+
+static void text_cache_flush(void)
+{
+    size_t n;
+
+    for (n = 0; n < TEXT_CACHE_SIZE; n++) {
+        if (text_cache[n].surface != NULL)
+            SDL_FreeSurface(text_cache[n].surface);
+        text_cache[n].surface = NULL;
+        text_cache[n].font = NULL;
+    }
+
+    for (n = 0; n < TEXT_CACHE_BUCKETS; n++)
+        text_bucket[n] = NULL;
+}
+
+/*
+ * Take the least recently used entry in the cache for re-use
+ *
+ * Return: entry, which is no longer in any hash bucket
+ */
+
+static struct text* text_cache_evict(void)
+{
+    struct text *t, **p;
+
+    t = list_entry(text_lru.prev, struct text, lru);
+    if (t->font == NULL)
+        return t; /* never used */
+
+    for (p = &text_bucket[t->hash % TEXT_CACHE_BUCKETS]; *p != t;
+         p = &(*p)->next)
+    {
+        assert(*p != NULL);
+    }
+    *p = t->next;
+
+    if (t->surface != NULL)
+        SDL_FreeSurface(t->surface);
+    t->font = NULL;
+
+    return t;
+}
+
+/*
+ * Get the rendering of some text, from the cache if possible
+ *
+ * Return: surface, or NULL on error
+ * Post: if *cached is false, the caller must free the surface
+ */
+
+static SDL_Surface* get_text(const char *buf, TTF_Font *font,
+                             SDL_Color fg, SDL_Color bg, bool locale,
+                             bool *cached)
+{
+    unsigned int h;
+    struct text *t, **bucket;
+    SDL_Surface *rendered, *converted;
+
+    if (strlen(buf) >= sizeof(t->buf)) {
+        *cached = false;
+        return render_text(buf, font, fg, bg, locale);
+    }
+
+    h = hash_text(buf, font, fg, bg, locale);
+    bucket = &text_bucket[h % TEXT_CACHE_BUCKETS];
+
+    for (t = *bucket; t != NULL; t = t->next) {
+        if (t->hash == h && t->font == font && t->locale == locale
+            && same_colour(t->fg, fg) && same_colour(t->bg, bg)
+            && strcmp(t->buf, buf) == 0)
+        {
+            list_del(&t->lru);
+            list_add(&t->lru, &text_lru);
+            *cached = true;
+            return t->surface;
+        }
+    }
+
+    rendered = render_text(buf, font, fg, bg, locale);
+    if (rendered == NULL) {
+        *cached = false;
+        return NULL;
+    }
+
+    /* Blits are quicker once in the format of the display */
+
+    converted = SDL_DisplayFormat(rendered);
+    if (converted != NULL) {
+        SDL_FreeSurface(rendered);
+        rendered = converted;
+    }
+
+    t = text_cache_evict();
+    t->hash = h;
+    t->font = font;
+    t->fg = fg;
+    t->bg = bg;
+    t->locale = locale;
+    strcpy(t->buf, buf);
+    t->surface = rendered;
+
+    t->next = *bucket;
+    *bucket = t;
+
+    list_del(&t->lru);
+    list_add(&t->lru, &text_lru);
+
+    *cached = true;
+    return t->surface;
+}
+
+/*
+ * Complete the remaining space, after some text was drawn, with a
+ * blank rectangle
+ */
+
+static void fill_after_text(SDL_Surface *sf, const struct rect *rect,
+                            int w, int h, SDL_Color bg)
+{
+    SDL_Rect fill;
+
+    if (w < rect->w) {
+        fill.x = rect->x + w;
+        fill.y = rect->y;
+        fill.w = rect->w - w;
+        fill.h = rect->h;
+        SDL_FillRect(sf, &fill, palette(sf, &bg));
+    }
+
+    if (h < rect->h) {
+        fill.x = rect->x;
+        fill.y = rect->y + h;
+        fill.w = w; /* the x-fill rectangle does the corner */
+        fill.h = rect->h - h;
+        SDL_FillRect(sf, &fill, palette(sf, &bg));
+    }
+}
+
 /*
  * Draw text
  *
@@ -405,71 +831,90 @@ static int do_draw_text(SDL_Surface *sf, const struct rect *rect,
                         const char *buf, TTF_Font *font,
                         SDL_Color fg, SDL_Color bg, bool locale)
 {
+    bool cached;
     SDL_Surface *rendered;
-    SDL_Rect dst, src, fill;
-
-    if (buf == NULL) {
-        src.w = 0;
-        src.h = 0;
+    SDL_Rect dst, src;
 
-    } else if (buf[0] == '\0') { /* SDL_ttf fails for empty string */
-        src.w = 0;
-        src.h = 0;
+    src.w = 0;
+    src.h = 0;
 
-    } else {
-        if (!locale) {
-            rendered = TTF_RenderText_Shaded(font, buf, fg, bg);
-        } else {
-            char ubuf[256], /* fixed buffer is reasonable for rendering */
-                *in, *out;
-            size_t len, fill;
+    /* SDL_ttf fails for empty string */
 
-            out = ubuf;
-            fill = sizeof(ubuf) - 1; /* always leave space for \0 */
+    if (buf != NULL && buf[0] != '\0') {
+        rendered = get_text(buf, font, fg, bg, locale, &cached);
 
-            if (iconv(utf, NULL, NULL, &out, &fill) == -1)
-                abort();
+        if (rendered != NULL) {
+            src.x = 0;
+            src.y = 0;
+            src.w = MIN(rect->w, rendered->w);
+            src.h = MIN(rect->h, rendered->h);
 
-            in = strdupa(buf);
-            len = strlen(in);
+            dst.x = rect->x;
+            dst.y = rect->y;
 
-            (void)iconv(utf, &in, &len, &out, &fill);
-            *out = '\0';
+            SDL_BlitSurface(rendered, &src, sf, &dst);
 
-            rendered = TTF_RenderUTF8_Shaded(font, ubuf, fg, bg);
+            if (!cached)
+                SDL_FreeSurface(rendered);
         }
+    }
+
+    fill_after_text(sf, rect, src.w, src.h, bg);
+
+    return src.w;
+}
+
+/*
+ * Draw text one character at a time, from the cache
+ *
+ * This is for text which changes often but has few different
+ * characters, such as a clock, so a redraw is only blitting. Any
+ * kerning is lost, so use it only with characters which have none.
+ *
+ * Return: width of text drawn
+ */
+
+static int draw_glyphs(SDL_Surface *sf, const struct rect *rect,
+                       const char *buf, TTF_Font *font,
+                       SDL_Color fg, SDL_Color bg)
+{
+    int w, h;
+
+    w = 0;
+    h = 0;
+
+    for (; *buf != '\0' && w < rect->w; buf++) {
+        bool cached;
+        char c[2];
+        SDL_Surface *rendered;
+        SDL_Rect dst, src;
+
+        c[0] = *buf;
+        c[1] = '\0';
+
+        rendered = get_text(c, font, fg, bg, false, &cached);
+        if (rendered == NULL)
+            break;
+        assert(cached);
 
         src.x = 0;
         src.y = 0;
-        src.w = MIN(rect->w, rendered->w);
+        src.w = MIN(rect->w - w, rendered->w);
         src.h = MIN(rect->h, rendered->h);
 
-        dst.x = rect->x;
+        dst.x = rect->x + w;
         dst.y = rect->y;
 
         SDL_BlitSurface(rendered, &src, sf, &dst);
-        SDL_FreeSurface(rendered);
-    }
-
-    /* Complete the remaining space with a blank rectangle */
 
-    if (src.w < rect->w) {
-        fill.x = rect->x + src.w;
-        fill.y = rect->y;
-        fill.w = rect->w - src.w;
-        fill.h = rect->h;
-        SDL_FillRect(sf, &fill, palette(sf, &bg));
+        w += src.w;
+        if (src.h > h)
+            h = src.h;
     }
 
-    if (src.h < rect->h) {
-        fill.x = rect->x;
-        fill.y = rect->y + src.h;
-        fill.w = src.w; /* the x-fill rectangle does the corner */
-        fill.h = rect->h - src.h;
-        SDL_FillRect(sf, &fill, palette(sf, &bg));
-    }
+    fill_after_text(sf, rect, w, h, bg);
 
-    return src.w;
+    return w;
 }
 
 static int draw_text(SDL_Surface *sf, const struct rect *rect,
@@ -599,6 +1044,42 @@ static SDL_Color hsv(double h, double s, double v)
     }
 }
 
+/*
+ * Mark an area of the screen to be updated
+ */
+
+static void damage(const struct rect *rect)
+{
+    SDL_Rect *r;
+
+    if (ndamaged == MAX_DAMAGE) {
+        damaged_all = true;
+        return;
+    }
+
+    r = &damaged[ndamaged++];
+    r->x = rect->x;
+    r->y = rect->y;
+    r->w = rect->w;
+    r->h = rect->h;
+}
+
+/*
+ * Update the areas of the screen which have been drawn, within the
+ * given rectangle
+ */
+
+static void update_damage(SDL_Surface *surface, const struct rect *rect)
+{
+    if (damaged_all)
+        UPDATE(surface, rect);
+    else if (ndamaged > 0)
+        SDL_UpdateRects(surface, ndamaged, damaged);
+
+    ndamaged = 0;
+    damaged_all = false;
+}
+
 static bool show_bpm(double bpm)
 {
     return (bpm > 20.0 && bpm < 400.0);
@@ -687,42 +1168,79 @@ static void draw_clock(SDL_Surface *surface, const struct rect *rect, int t,
 
     time_to_clock(hms, deci, t);
 
-    v = draw_text(surface, rect, hms, clock_font, col, background_col);
+    v = draw_glyphs(surface, rect, hms, clock_font, col, background_col);
 
     split(*rect, pixels(from_left(v, 0)), NULL, &sr);
     track_baseline(&sr, clock_font, &sr, deci_font);
 
-    draw_text(surface, &sr, deci, deci_font, col, background_col);
+    draw_glyphs(surface, &sr, deci, deci_font, col, background_col);
 }
 
 /*
  * Draw the visual monitor of the input audio to the timecoder
+ *
+ * The monitor is brought up to date only as the snapshot is taken;
+ * in between, it is written to only by this thread.
  */
 
 static void draw_scope(SDL_Surface *surface, const struct rect *rect,
-                       struct timecoder *tc)
+                       struct timecoder *tc, const struct deck_snapshot *ds,
+                       struct deck_view *view)
 {
-    int r, c, v, mid;
-    Uint8 *p;
+    int n, mid;
+    SDL_Rect dst;
 
-    mid = tc->mon_size / 2;
+    if (!ds->scope_changed && view->valid)
+        return;
 
-    for (r = 0; r < tc->mon_size; r++) {
-        for (c = 0; c < tc->mon_size; c++) {
-            p = surface->pixels
-                + (rect->y + r) * surface->pitch
-                + (rect->x + c) * surface->format->BytesPerPixel;
+    /* The monitor is used directly as a greyscale image */
 
-            v = tc->mon[r * tc->mon_size + c];
+    if (view->scope == NULL) {
+        SDL_Color grey[256];
 
-            if ((r == mid || c == mid) && v < 64)
-                v = 64;
+        view->scope = SDL_CreateRGBSurfaceFrom(tc->mon,
+                                               tc->mon_size, tc->mon_size,
+                                               8, tc->mon_size, 0, 0, 0, 0);
+        if (view->scope == NULL) {
+            fprintf(stderr, "%s\n", SDL_GetError());
+            return;
+        }
+
+        for (n = 0; n < 256; n++)
+            grey[n].r = grey[n].g = grey[n].b = n;
+        SDL_SetColors(view->scope, grey, 0, 256);
+    }
+
+    dst.x = rect->x;
+    dst.y = rect->y;
+    SDL_BlitSurface(view->scope, NULL, surface, &dst);
+
+    /* Cross hairs */
+
+    mid = tc->mon_size / 2;
 
-            p[0] = v;
-            p[1] = p[0];
-            p[2] = p[1];
+    for (n = 0; n < tc->mon_size; n++) {
+        int v;
+        Uint8 *p;
+
+        v = tc->mon[mid * tc->mon_size + n];
+        if (v < 64) {
+            p = surface->pixels
+                + (rect->y + mid) * surface->pitch
+                + (rect->x + n) * surface->format->BytesPerPixel;
+            p[0] = p[1] = p[2] = 64;
+        }
+
+        v = tc->mon[n * tc->mon_size + mid];
+        if (v < 64) {
+            p = surface->pixels
+                + (rect->y + n) * surface->pitch
+                + (rect->x + mid) * surface->format->BytesPerPixel;
+            p[0] = p[1] = p[2] = 64;
         }
     }
+
+    damage(rect);
 }
 
 /*
@@ -733,187 +1251,503 @@ static void draw_scope(SDL_Surface *surface, const struct rect *rect,
  */
 
 static void draw_spinner(SDL_Surface *surface, const struct rect *rect,
-                         struct player *pl)
+                         const struct deck_snapshot *ds,
+                         struct deck_view *view)
 {
-    int x, y, r, c, rangle, pangle;
-    double elapsed, remain, rps;
-    Uint8 *rp, *p;
+    int frame;
+    bool alert;
+    SDL_Rect dst;
+
+    frame = (int)(ds->position * SPINNER_FRAMES * ds->rps) % SPINNER_FRAMES;
+    if (frame < 0)
+        frame += SPINNER_FRAMES;
+
+    alert = (ds->elapsed < 0 || ds->remain < 0);
+
+    if (view->valid && view->rangle == frame && view->alert == alert)
+        return;
+    view->rangle = frame;
+    view->alert = alert;
+
+    dst.x = rect->x;
+    dst.y = rect->y;
+    SDL_BlitSurface(spinner_frame[alert][frame], NULL, surface, &dst);
+
+    damage(rect);
+}
+
+/*
+ * Draw the clocks which show time elapsed and time remaining
+ */
+
+static void draw_deck_clocks(SDL_Surface *surface, const struct rect *rect,
+                             const struct deck_snapshot *ds,
+                             struct deck_view *view)
+{
+    int elapse, remain;
+    bool importing;
+    struct rect upper, lower;
     SDL_Color col;
 
-    x = rect->x;
-    y = rect->y;
+    split(*rect, from_top(CLOCK_FONT_SIZE, 0), &upper, &lower);
+
+    elapse = ds->elapsed * 1000;
+    remain = ds->remain * 1000;
+    importing = track_is_importing(ds->track);
 
-    elapsed = player_get_elapsed(pl);
-    remain = player_get_remain(pl);
+    if (view->valid && view->elapse == elapse && view->remain == remain
+        && view->importing == importing)
+    {
+        return;
+    }
 
-    rps = timecoder_revs_per_sec(pl->timecoder);
-    rangle = (int)(player_get_position(pl) * 1024 * rps) % 1024;
+    view->elapse = elapse;
+    view->remain = remain;
+    view->importing = importing;
 
-    if (elapsed < 0 || remain < 0)
+    if (elapse < 0)
         col = alert_col;
-    else
+    else if (remain > 0)
         col = ok_col;
+    else
+        col = text_col;
+
+    draw_clock(surface, &upper, elapse, col);
+
+    if (remain <= 0)
+        col = alert_col;
+    else
+        col = text_col;
 
-    for (r = 0; r < spinner_size; r++) {
+    if (importing)
+        col = dim(col, 2);
 
-        /* Store a pointer to this row of the framebuffer */
+    draw_clock(surface, &lower, -remain, col);
 
-        rp = surface->pixels + (y + r) * surface->pitch;
+    damage(rect);
+}
 
-        for (c = 0; c < spinner_size; c++) {
+/*
+ * Calculate the colour of the waveform for each combination of
+ * frequency bands; low is red, mid is green and high is blue, at the
+ * brightness of the loudest
+ */
 
-            /* Use the lookup table to provide the angle at each
-             * pixel */
+static void init_band_colours(void)
+{
+    int n;
 
-            pangle = spinner_angle[r * spinner_size + c];
+    for (n = 0; n < (1 << (BAND_BITS * BANDS)); n++) {
+        int low, mid, high, top;
+        SDL_Color *col;
 
-            /* Calculate the final pixel location and set it */
+        low = n >> (BAND_BITS * 2);
+        mid = (n >> BAND_BITS) & ((1 << BAND_BITS) - 1);
+        high = n & ((1 << BAND_BITS) - 1);
+        top = MAX(low, MAX(mid, high));
 
-            p = rp + (x + c) * surface->format->BytesPerPixel;
+        col = &band_lut[n];
 
-            if ((rangle - pangle + 1024) % 1024 < 512) {
-                p[0] = col.b >> 2;
-                p[1] = col.g >> 2;
-                p[2] = col.r >> 2;
-            } else {
-                p[0] = col.b;
-                p[1] = col.g;
-                p[2] = col.r;
-            }
+        if (top == 0) {
+            *col = elapsed_col;
+        } else {
+            col->r = 255 * low / top;
+            col->g = 255 * mid / top;
+            col->b = 255 * high / top;
         }
     }
 }
 
 /*
- * Draw the clocks which show time elapsed and time remaining
+ * Return: colour of the waveform at the given sample
  */
 
-static void draw_deck_clocks(SDL_Surface *surface, const struct rect *rect,
-                             struct player *pl, struct track *track)
+static SDL_Color band_colour(struct track *tr, int sp)
 {
-    int elapse, remain;
-    struct rect upper, lower;
-    SDL_Color col;
+    const unsigned char *b;
+    int shift;
 
-    split(*rect, from_top(CLOCK_FONT_SIZE, 0), &upper, &lower);
+    b = track_get_bands(tr, sp);
+    shift = 8 - BAND_BITS;
 
-    elapse = player_get_elapsed(pl) * 1000;
-    remain = player_get_remain(pl) * 1000;
+    return band_lut[(b[BAND_LOW] >> shift) << (BAND_BITS * 2)
+                    | (b[BAND_MID] >> shift) << BAND_BITS
+                    | b[BAND_HIGH] >> shift];
+}
 
-    if (elapse < 0)
-        col = alert_col;
-    else if (remain > 0)
-        col = ok_col;
+/*
+ * Draw a single column of the overview meter
+ */
+
+static void draw_overview_column(SDL_Surface *surface, int x, int y, int h,
+                                 int height, SDL_Color col, int fade)
+{
+    int r, pitch;
+    Uint8 *p;
+
+    pitch = surface->pitch;
+    p = (Uint8*)surface->pixels + y * pitch
+        + x * surface->format->BytesPerPixel;
+
+    r = h;
+    while (r > height) {
+        p[0] = col.b >> fade;
+        p[1] = col.g >> fade;
+        p[2] = col.r >> fade;
+        p += pitch;
+        r--;
+    }
+    while (r) {
+        p[0] = col.b;
+        p[1] = col.g;
+        p[2] = col.r;
+        p += pitch;
+        r--;
+    }
+}
+
+/*
+ * Return: height of the overview meter in the given column
+ */
+
+static int overview_height(struct track *tr, int c, int w, int h)
+{
+    int sp;
+
+    sp = (long long)tr->length * c / w;
+
+    if (track_is_filled(tr, sp)) /* and account for rounding */
+        return track_get_overview(tr, sp) * h / 256;
     else
-        col = text_col;
+        return 0;
+}
 
-    draw_clock(surface, &upper, elapse, col);
+/*
+ * Return: colour of the overview meter in the given column
+ */
+
+static SDL_Color overview_colour(struct track *tr, int c, int w)
+{
+    int sp;
+
+    sp = (long long)tr->length * c / w;
+
+    if (track_is_filled(tr, sp))
+        return band_colour(tr, sp);
+    else
+        return elapsed_col;
+}
+
+/*
+ * Free the images of the overview meter
+ */
+
+static void clear_overview(struct deck_view *view)
+{
+    size_t n;
+
+    for (n = 0; n < 2; n++) {
+        if (view->overview[n] != NULL)
+            SDL_FreeSurface(view->overview[n]);
+        view->overview[n] = NULL;
+    }
+}
+
+/*
+ * Forget the state of the decks, so they are drawn in full
+ */
+
+static void invalidate_decks(void)
+{
+    size_t n;
+
+    for (n = 0; n < ndeck; n++) {
+        view[n].valid = false;
+        clear_overview(&view[n]);
+
+        if (view[n].scope != NULL)
+            SDL_FreeSurface(view[n].scope);
+        view[n].scope = NULL;
+    }
+}
+
+/*
+ * Make the images of the overview meter the given size, keeping
+ * them if they already are
+ *
+ * Return: 0 on success, or -1 if the images could not be made
+ */
+
+static int size_overview(SDL_Surface *surface, int w, int h,
+                         struct deck_view *view)
+{
+    size_t n;
+
+    if (view->overview[0] != NULL
+        && view->overview[0]->w == w && view->overview[0]->h == h)
+    {
+        return 0;
+    }
+
+    clear_overview(view);
+
+    for (n = 0; n < 2; n++) {
+        SDL_Surface *sf;
+        SDL_PixelFormat *f;
+
+        f = surface->format;
+        sf = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, f->BitsPerPixel,
+                                  f->Rmask, f->Gmask, f->Bmask, f->Amask);
+        if (sf == NULL) {
+            fprintf(stderr, "%s\n", SDL_GetError());
+            clear_overview(view);
+            return -1;
+        }
+
+        view->overview[n] = sf;
+    }
+
+    return 0;
+}
+
+/*
+ * Render columns of the overview meter, both as unplayed and played,
+ * into images which are blitted to the screen
+ *
+ * Pre: images are the size of the meter
+ */
+
+static void render_overview(struct track *tr, int w, int h, int from, int to,
+                            bool warning, bool importing,
+                            struct deck_view *view)
+{
+    int c;
+
+    LOCK(view->overview[0]);
+    LOCK(view->overview[1]);
+
+    for (c = from; c < to; c++) {
+        int height;
+        SDL_Color col;
+
+        if (warning)
+            col = alert_col;
+        else
+            col = overview_colour(tr, c, w);
+
+        if (importing)
+            col = dim(col, 1);
+
+        height = overview_height(tr, c, w, h);
+        draw_overview_column(view->overview[0], c, 0, h, height, col, 3);
+        draw_overview_column(view->overview[1], c, 0, h, height,
+                             dim(col, 1), 3);
+    }
+
+    UNLOCK(view->overview[1]);
+    UNLOCK(view->overview[0]);
+}
+
+/*
+ * Blit some columns of an image of the overview meter
+ */
+
+static void blit_overview(SDL_Surface *surface, const struct rect *rect,
+                          SDL_Surface *image, int from, int to)
+{
+    SDL_Rect src, dst;
+
+    if (to <= from)
+        return;
+
+    src.x = from;
+    src.y = 0;
+    src.w = to - from;
+    src.h = rect->h;
+
+    dst.x = rect->x + from;
+    dst.y = rect->y;
+
+    SDL_BlitSurface(image, &src, surface, &dst);
+}
+
+/*
+ * Draw a mark along the top of the overview meter in each column
+ * which has a cue point
+ */
+
+static void draw_markers(SDL_Surface *surface, const struct rect *rect,
+                         const unsigned char *marker)
+{
+    int c, w;
+
+    w = rect->w;
+
+    for (c = 0; c < w; c++) {
+        int n, end;
 
-    if (remain <= 0)
-        col = alert_col;
-    else
-        col = text_col;
+        n = (long long)c * OVERVIEW_MARKERS / w;
+        end = (long long)(c + 1) * OVERVIEW_MARKERS / w;
+        if (end == n)
+            end = n + 1;
 
-    if (track_is_importing(track))
-        col = dim(col, 2);
+        while (n < end && marker[n] == 0)
+            n++;
 
-    draw_clock(surface, &lower, -remain, col);
+        if (n < end) {
+            draw_overview_column(surface, rect->x + c, rect->y,
+                                 MARKER_HEIGHT, MARKER_HEIGHT, marker_col, 0);
+        }
+    }
 }
 
 /*
  * Draw the high-level overview meter which shows the whole length
  * of the track
+ *
+ * The meter is rendered once for each length of the track, which
+ * changes only during import. Otherwise the meter is blitted either
+ * side of the needle, and only the columns of audio imported into
+ * the hole since are rendered again.
  */
 
 static void draw_overview(SDL_Surface *surface, const struct rect *rect,
-                          struct track *tr, int position)
+                          const struct deck_snapshot *ds, int position,
+                          struct deck_view *view)
 {
-    int x, y, w, h, r, c, sp, fade, bytes_per_pixel, pitch, height,
-        current_position;
-    Uint8 *pixels, *p;
+    struct track *tr = ds->track;
+    int w, h, current_position, played, from, to;
+    bool warning, importing, fresh, filled;
     SDL_Color col;
 
-    x = rect->x;
-    y = rect->y;
     w = rect->w;
     h = rect->h;
 
-    pixels = surface->pixels;
-    bytes_per_pixel = surface->format->BytesPerPixel;
-    pitch = surface->pitch;
-
     if (tr->length)
         current_position = (long long)position * w / tr->length;
     else
         current_position = 0;
 
-    for (c = 0; c < w; c++) {
+    warning = (position > tr->length - tr->rate * METER_WARNING_TIME);
+    importing = track_is_importing(tr);
 
-        /* Collect the correct meter value for this column */
+    /* The colour of the whole meter changes with these */
 
-        sp = (long long)tr->length * c / w;
+    fresh = !(view->valid && view->track == tr && view->length == tr->length
+              && view->hole <= tr->hole_start
+              && view->warning == warning
+              && view->meters_importing == importing);
 
-        if (sp < tr->length) /* account for rounding */
-            height = track_get_overview(tr, sp) * h / 256;
-        else
-            height = 0;
+    filled = (view->hole != tr->hole_start);
 
-        /* Choose a base colour to display in */
+    if (!fresh && !filled && !ds->markers_changed
+        && view->needle == current_position)
+    {
+        return;
+    }
 
-        if (!tr->length) {
-            col = background_col;
-            fade = 0;
-        } else if (c == current_position) {
-            col = needle_col;
-            fade = 1;
-        } else if (position > tr->length - tr->rate * METER_WARNING_TIME) {
-            col = alert_col;
-            fade = 3;
-        } else {
-            col = elapsed_col;
-            fade = 3;
-        }
+    view->needle = current_position;
+    view->warning = warning;
 
-        if (track_is_importing(tr))
-            col = dim(col, 1);
+    if (!tr->length) {
+        draw_rect(surface, rect, background_col);
+        damage(rect);
+        return;
+    }
+
+    if (fresh || view->overview[0] == NULL) {
+        if (size_overview(surface, w, h, view) == -1)
+            return;
+
+        from = 0;
+        to = w;
 
-        if (c < current_position)
+    } else if (filled) {
+        from = (long long)view->hole * w / tr->length;
+        to = (long long)tr->hole_start * w / tr->length + 1;
+        if (to > w)
+            to = w;
+
+    } else {
+        from = to = 0;
+    }
+
+    render_overview(tr, w, h, from, to, warning, importing, view);
+
+    played = current_position;
+    if (played < 0)
+        played = 0;
+    if (played > w)
+        played = w;
+
+    blit_overview(surface, rect, view->overview[1], 0, played);
+    blit_overview(surface, rect, view->overview[0], played, w);
+
+    if (h > MARKER_HEIGHT)
+        draw_markers(surface, rect, ds->marker);
+
+    if (current_position >= 0 && current_position < w) {
+        col = needle_col;
+        if (importing)
             col = dim(col, 1);
 
-        /* Store a pointer to this column of the framebuffer */
+        draw_overview_column(surface, rect->x + current_position, rect->y, h,
+                             overview_height(tr, current_position, w, h),
+                             col, 1);
+    }
 
-        p = pixels + y * pitch + (x + c) * bytes_per_pixel;
+    damage(rect);
+}
 
-        r = h;
-        while (r > height) {
-            p[0] = col.b >> fade;
-            p[1] = col.g >> fade;
-            p[2] = col.r >> fade;
-            p += pitch;
-            r--;
-        }
-        while (r) {
-            p[0] = col.b;
-            p[1] = col.g;
-            p[2] = col.r;
-            p += pitch;
-            r--;
-        }
+/*
+ * Set a run of pixels in a row to a colour
+ *
+ * Return: pointer to the pixel after the run
+ */
+
+static Uint8* draw_run(Uint8 *p, int n, SDL_Color col, int fade,
+                       size_t bytes_per_pixel)
+{
+    while (n-- > 0) {
+        p[0] = col.b >> fade;
+        p[1] = col.g >> fade;
+        p[2] = col.r >> fade;
+        p += bytes_per_pixel;
     }
+
+    return p;
 }
 
 /*
  * Draw the close-up meter, which can be zoomed to a level set by
  * 'scale'
+ *
+ * Each column is the summary of 2^scale samples; the extent of the
+ * waveform is shown dimmed, and its RMS level in full.
  */
 
 static void draw_closeup(SDL_Surface *surface, const struct rect *rect,
-                         struct track *tr, int position, int scale)
+                         struct track *tr, int position, int scale,
+                         struct deck_view *view)
 {
     int x, y, w, h, c;
     size_t bytes_per_pixel, pitch;
     Uint8 *pixels;
 
+    assert(scale <= TRACK_PEAK_MAX);
+
+    /* Only a change of a whole column shows */
+
+    if (view->valid && view->track == tr && view->length == tr->length
+        && view->hole == tr->hole_start
+        && view->closeup == position >> scale && view->scale == scale)
+    {
+        return;
+    }
+
+    view->closeup = position >> scale;
+    view->scale = scale;
+
     x = rect->x;
     y = rect->y;
     w = rect->w;
@@ -927,22 +1761,30 @@ static void draw_closeup(SDL_Surface *surface, const struct rect *rect,
      * but oprofile shows it makes no difference */
 
     for (c = 0; c < h; c++) {
-        int r, sp, width, blank, fade;
+        int sp, lo, hi, rms_lo, rms_hi, fade;
         Uint8 *p;
         SDL_Color col;
 
-        /* Work out the meter height in pixels for this column */
+        /* Work out the extent of the waveform in pixels for this
+         * column */
 
         sp = position - (position % (1 << scale))
             + ((c - h / 2) << scale);
 
-        if (sp < tr->length && sp > 0) {
-            width = track_get_ppm(tr, sp) * w / 254;
-            blank = (w - width) / 2;
-        }
-        else {
-            width = 0;
-            blank = w;
+        if (track_is_filled(tr, sp) && sp > 0) {
+            struct track_peak peak;
+
+            track_get_summary(tr, sp, scale, &peak);
+
+            lo = w / 2 + peak.min * w / 256;
+            hi = w / 2 + peak.max * w / 256;
+            rms_lo = MIN(MAX(w / 2 - peak.rms * w / 256, lo), hi);
+            rms_hi = MAX(MIN(w / 2 + peak.rms * w / 256, hi), rms_lo);
+        } else {
+            lo = w / 2;
+            hi = lo;
+            rms_lo = lo;
+            rms_hi = lo;
         }
 
         /* Select the appropriate colour */
@@ -950,6 +1792,9 @@ static void draw_closeup(SDL_Surface *surface, const struct rect *rect,
         if (c == h / 2) {
             col = needle_col;
             fade = 1;
+        } else if (track_is_filled(tr, sp) && sp > 0) {
+            col = band_colour(tr, sp);
+            fade = 3;
         } else {
             col = elapsed_col;
             fade = 3;
@@ -960,29 +1805,14 @@ static void draw_closeup(SDL_Surface *surface, const struct rect *rect,
 
         p = pixels + (y + c) * pitch + x * bytes_per_pixel;
 
-        r = 0;
-        while(r < blank) {
-            p[0] = col.b >> fade;
-            p[1] = col.g >> fade;
-            p[2] = col.r >> fade;
-            p += bytes_per_pixel;
-            r++;
-        }
-        while(r < width + blank) {
-            p[0] = col.b;
-            p[1] = col.g;
-            p[2] = col.r;
-            p += bytes_per_pixel;
-            r++;
-        }
-        while(r < w) {
-            p[0] = col.b >> fade;
-            p[1] = col.g >> fade;
-            p[2] = col.r >> fade;
-            p += bytes_per_pixel;
-            r++;
-        }
+        p = draw_run(p, lo, col, fade, bytes_per_pixel);
+        p = draw_run(p, rms_lo - lo, col, fade / 2, bytes_per_pixel);
+        p = draw_run(p, rms_hi - rms_lo, col, 0, bytes_per_pixel);
+        p = draw_run(p, hi - rms_hi, col, fade / 2, bytes_per_pixel);
+        (void)draw_run(p, w - hi, col, fade, bytes_per_pixel);
     }
+
+    damage(rect);
 }
 
 /*
@@ -990,18 +1820,25 @@ static void draw_closeup(SDL_Surface *surface, const struct rect *rect,
  */
 
 static void draw_meters(SDL_Surface *surface, const struct rect *rect,
-                        struct track *tr, int position, int scale)
+                        const struct deck_snapshot *ds, int position,
+                        int scale, struct deck_view *view)
 {
     struct rect overview, closeup;
+    struct track *tr = ds->track;
 
     split(*rect, from_top(OVERVIEW_HEIGHT, SPACER), &overview, &closeup);
 
     if (closeup.h > MIN_CLOSEUP)
-        draw_overview(surface, &overview, tr, position);
+        draw_overview(surface, &overview, ds, position, view);
     else
         closeup = *rect;
 
-    draw_closeup(surface, &closeup, tr, position, scale);
+    draw_closeup(surface, &closeup, tr, position, scale, view);
+
+    view->track = tr;
+    view->length = tr->length;
+    view->hole = tr->hole_start;
+    view->meters_importing = track_is_importing(tr);
 }
 
 /*
@@ -1009,7 +1846,8 @@ static void draw_meters(SDL_Surface *surface, const struct rect *rect,
  */
 
 static void draw_deck_top(SDL_Surface *surface, const struct rect *rect,
-                          struct player *pl, struct track *track)
+                          struct timecoder *tc, const struct deck_snapshot *ds,
+                          struct deck_view *view)
 {
     struct rect clocks, left, right, spinner, scope;
 
@@ -1018,24 +1856,24 @@ static void draw_deck_top(SDL_Surface *surface, const struct rect *rect,
     /* If there is no timecoder to display information on, or not enough
      * available space, just draw clocks which span the overall space */
 
-    if (!pl->timecode_control || right.w < 0) {
-        draw_deck_clocks(surface, rect, pl, track);
+    if (!ds->timecode_control || right.w < 0) {
+        draw_deck_clocks(surface, rect, ds, view);
         return;
     }
 
-    draw_deck_clocks(surface, &clocks, pl, track);
+    draw_deck_clocks(surface, &clocks, ds, view);
 
     split(right, from_right(SPINNER_SIZE, SPACER), &left, &spinner);
     if (left.w < 0)
         return;
     split(spinner, from_bottom(SPINNER_SIZE, 0), NULL, &spinner);
-    draw_spinner(surface, &spinner, pl);
+    draw_spinner(surface, &spinner, ds, view);
 
     split(left, from_right(SCOPE_SIZE, SPACER), &clocks, &scope);
     if (clocks.w < 0)
         return;
     split(scope, from_bottom(SCOPE_SIZE, 0), NULL, &scope);
-    draw_scope(surface, &scope, pl->timecoder);
+    draw_scope(surface, &scope, tc, ds, view);
 }
 
 /*
@@ -1045,32 +1883,35 @@ static void draw_deck_top(SDL_Surface *surface, const struct rect *rect,
 
 static void draw_deck_status(SDL_Surface *surface,
                              const struct rect *rect,
-                             const struct deck *deck)
+                             const struct deck_snapshot *ds,
+                             struct deck_view *view)
 {
     char buf[128], *c;
-    int tc;
-    const struct player *pl = &deck->player;
 
     c = buf;
 
-    c += sprintf(c, "%s: ", pl->timecoder->def->name);
+    c += sprintf(c, "%s: ", ds->timecode);
 
-    tc = timecoder_get_position(pl->timecoder, NULL);
-    if (pl->timecode_control && tc != -1) {
-        c += sprintf(c, "%7d ", tc);
+    if (ds->timecode_control && ds->timecode_position != -1) {
+        c += sprintf(c, "%7d ", ds->timecode_position);
     } else {
         c += sprintf(c, "        ");
     }
 
     sprintf(c, "pitch:%+0.2f (sync %0.2f %+.5fs = %+0.2f)  %s%s",
-            pl->pitch,
-            pl->sync_pitch,
-            pl->last_difference,
-            pl->pitch * pl->sync_pitch,
-            pl->recalibrate ? "RCAL  " : "",
-            deck_is_locked(deck) ? "LOCK  " : "");
+            ds->pitch,
+            ds->sync_pitch,
+            ds->last_difference,
+            ds->pitch * ds->sync_pitch,
+            ds->recalibrate ? "RCAL  " : "",
+            ds->locked ? "LOCK  " : "");
+
+    if (view->valid && strcmp(view->status, buf) == 0)
+        return;
+    strcpy(view->status, buf);
 
     draw_text(surface, rect, buf, detail_font, detail_col, background_col);
+    damage(rect);
 }
 
 /*
@@ -1078,37 +1919,48 @@ static void draw_deck_status(SDL_Surface *surface,
  */
 
 static void draw_deck(SDL_Surface *surface, const struct rect *rect,
-                      struct deck *deck, int meter_scale)
+                      struct deck *deck, const struct deck_snapshot *ds,
+                      int meter_scale, struct deck_view *view)
 {
     int position;
     struct rect track, top, meters, status, rest, lower;
-    struct player *pl;
     struct track *t;
 
-    pl = &deck->player;
-    t = pl->track;
+    t = ds->track;
+
+    position = ds->elapsed * t->rate;
 
-    position = player_get_elapsed(pl) * t->rate;
+    /* The layout of the top of the deck depends on the timecoder */
+
+    if (view->timecode_control != ds->timecode_control) {
+        view->timecode_control = ds->timecode_control;
+        view->valid = false;
+    }
 
     split(*rect, from_top(FONT_SPACE + BIG_FONT_SPACE, 0), &track, &rest);
-    if (rest.h < 160)
+    if (rest.h < 160) {
         rest = *rect;
-    else
-        draw_record(surface, &track, deck->record);
+    } else if (!view->valid || view->record != ds->record) {
+        draw_record(surface, &track, ds->record);
+        view->record = ds->record;
+        damage(&track);
+    }
 
     split(rest, from_top(CLOCK_FONT_SIZE * 2, SPACER), &top, &lower);
     if (lower.h < 64)
         lower = rest;
     else
-        draw_deck_top(surface, &top, pl, t);
+        draw_deck_top(surface, &top, &deck->timecoder, ds, view);
 
     split(lower, from_bottom(FONT_SPACE, SPACER), &meters, &status);
     if (meters.h < 64)
         meters = lower;
     else
-        draw_deck_status(surface, &status, deck);
+        draw_deck_status(surface, &status, ds, view);
 
-    draw_meters(surface, &meters, t, position, meter_scale);
+    draw_meters(surface, &meters, ds, position, meter_scale, view);
+
+    view->valid = true;
 }
 
 /*
@@ -1116,7 +1968,8 @@ static void draw_deck(SDL_Surface *surface, const struct rect *rect,
  */
 
 static void draw_decks(SDL_Surface *surface, const struct rect *rect,
-                       struct deck deck[], size_t ndecks, int meter_scale)
+                       struct deck deck[], const struct deck_snapshot ds[],
+                       size_t ndecks, int meter_scale)
 {
     int d;
     struct rect left, right;
@@ -1125,7 +1978,7 @@ static void draw_decks(SDL_Surface *surface, const struct rect *rect,
 
     for (d = 0; d < ndecks; d++) {
         split(right, columns(d, ndecks, BORDER), &left, &right);
-        draw_deck(surface, &left, &deck[d], meter_scale);
+        draw_deck(surface, &left, &deck[d], &ds[d], meter_scale, &view[d]);
     }
 }
 
@@ -1133,11 +1986,12 @@ static void draw_decks(SDL_Surface *surface, const struct rect *rect,
  * Draw the status bar
  */
 
-static void draw_status(SDL_Surface *sf, const struct rect *rect)
+static void draw_status(SDL_Surface *sf, const struct rect *rect,
+                        const struct snapshot *sn)
 {
     SDL_Color fg, bg;
 
-    switch (status_level()) {
+    switch (sn->status_level) {
     case STATUS_ALERT:
     case STATUS_WARN:
         fg = text_col;
@@ -1148,7 +2002,7 @@ static void draw_status(SDL_Surface *sf, const struct rect *rect)
         bg = background_col;
     }
 
-    draw_text_in_locale(sf, rect, status(), detail_font, fg, bg);
+    draw_text_in_locale(sf, rect, sn->status, detail_font, fg, bg);
 }
 
 /*
@@ -1156,18 +2010,18 @@ static void draw_status(SDL_Surface *sf, const struct rect *rect)
  */
 
 static void draw_search(SDL_Surface *surface, const struct rect *rect,
-                        struct selector *sel)
+                        const struct snapshot *sn)
 {
     int s;
     const char *buf;
-    char cm[32];
+    char cm[64];
     SDL_Rect cursor;
     struct rect rtext;
 
     split(*rect, from_left(SCROLLBAR_SIZE, SPACER), NULL, &rtext);
 
-    if (sel->search[0] != '\0')
-        buf = sel->search;
+    if (sn->search[0] != '\0')
+        buf = sn->search;
     else
         buf = NULL;
 
@@ -1180,13 +2034,17 @@ static void draw_search(SDL_Surface *surface, const struct rect *rect,
 
     SDL_FillRect(surface, &cursor, palette(surface, &cursor_col));
 
-    if (sel->view_index->entries > 1)
-        sprintf(cm, "%zd matches", sel->view_index->entries);
-    else if (sel->view_index->entries > 0)
+    if (sn->matches > 1)
+        sprintf(cm, "%zd matches", sn->matches);
+    else if (sn->matches > 0)
         sprintf(cm, "1 match");
     else
         sprintf(cm, "no matches");
 
+    if (sn->bpm > 0.0) {
+        sprintf(cm + strlen(cm), " near %0.1f BPM", sn->bpm);
+    }
+
     rtext.x += s + CURSOR_WIDTH + SPACER;
     rtext.w -= s + CURSOR_WIDTH + SPACER;
 
@@ -1271,12 +2129,12 @@ static void draw_crate_row(const void *context,
                            SDL_Surface *surface, const struct rect rect,
                            unsigned int entry, bool selected)
 {
-    const struct selector *selector = context;
-    const struct crate *crate;
+    const struct snapshot *sn = context;
+    const struct crate_row *crate;
     struct rect left, right;
     SDL_Color col;
 
-    crate = selector->library->crate[entry];
+    crate = &sn->crate[entry - sn->crates.offset];
 
     if (crate->is_fixed)
         col = detail_col;
@@ -1291,7 +2149,7 @@ static void draw_crate_row(const void *context,
 
     split(rect, from_right(SORT_WIDTH, 0), &left, &right);
 
-    switch (selector->sort) {
+    switch (sn->sort) {
     case SORT_ARTIST:
         draw_token(surface, &right, "ART", text_col, artist_col, selected_col);
         break;
@@ -1322,9 +2180,9 @@ static void draw_crate_row(const void *context,
  */
 
 static void draw_crates(SDL_Surface *surface, const struct rect rect,
-                        const struct selector *x)
+                        const struct snapshot *sn)
 {
-    draw_listbox(&x->crates, surface, rect, x, draw_crate_row);
+    draw_listbox(&sn->crates, surface, rect, sn, draw_crate_row);
 }
 
 static void draw_record_row(const void *context,
@@ -1333,7 +2191,7 @@ static void draw_record_row(const void *context,
 {
     int width;
     struct record *record;
-    const struct index *index = context;
+    const struct snapshot *sn = context;
     struct rect left, right;
     SDL_Color col;
 
@@ -1346,7 +2204,7 @@ static void draw_record_row(const void *context,
     if (width > RESULTS_ARTIST_WIDTH)
         width = RESULTS_ARTIST_WIDTH;
 
-    record = index->record[entry];
+    record = sn->record[entry - sn->records.offset];
 
     split(rect, from_left(BPM_WIDTH, 0), &left, &right);
     draw_bpm_field(surface, &left, record->bpm, col);
@@ -1368,9 +2226,22 @@ static void draw_record_row(const void *context,
  */
 
 static void draw_index(SDL_Surface *surface, const struct rect rect,
-                         const struct selector *x)
+                       const struct snapshot *sn)
+{
+    draw_listbox(&sn->records, surface, rect, sn, draw_record_row);
+}
+
+/*
+ * Return: number of rows for each list in the music library, or zero
+ * if there is only space for the query
+ */
+
+static unsigned int library_rows(const struct rect *rect)
 {
-    draw_listbox(&x->records, surface, rect, x->view_index, draw_record_row);
+    struct rect rlists;
+
+    split(*rect, from_top(SEARCH_HEIGHT, SPACER), NULL, &rlists);
+    return count_rows(rlists, FONT_SPACE);
 }
 
 /*
@@ -1379,36 +2250,54 @@ static void draw_index(SDL_Surface *surface, const struct rect rect,
  */
 
 static void draw_library(SDL_Surface *surface, const struct rect *rect,
-                         struct selector *sel)
+                         const struct snapshot *sn)
 {
     struct rect rsearch, rlists, rcrates, rrecords;
-    unsigned int rows;
 
     split(*rect, from_top(SEARCH_HEIGHT, SPACER), &rsearch, &rlists);
 
-    rows = count_rows(rlists, FONT_SPACE);
-    if (rows == 0) {
+    if (sn->rows == 0) {
 
         /* Hide the selector: draw nothing, and make it a 'virtual'
          * one row selector. This is enough to use it from the search
          * field and status only */
 
-        draw_search(surface, rect, sel);
-        selector_set_lines(sel, 1);
-
+        draw_search(surface, rect, sn);
         return;
     }
 
-    draw_search(surface, &rsearch, sel);
-    selector_set_lines(sel, rows);
+    draw_search(surface, &rsearch, sn);
 
     split(rlists, columns(0, 4, SPACER), &rcrates, &rrecords);
     if (rcrates.w > LIBRARY_MIN_WIDTH) {
-        draw_index(surface, rrecords, sel);
-        draw_crates(surface, rcrates, sel);
+        draw_index(surface, rrecords, sn);
+        draw_crates(surface, rcrates, sn);
     } else {
-        draw_index(surface, *rect, sel);
+        draw_index(surface, *rect, sn);
+    }
+}
+
+/*
+ * Show only records of a tempo compatible with the given deck, at
+ * its current pitch
+ */
+
+static void select_tempo(struct selector *sel, struct deck *de)
+{
+    double pitch;
+    struct player *pl;
+
+    if (de->record == NULL || de->record->bpm == 0.0) {
+        status_set(STATUS_WARN, "No BPM is known for this deck");
+        return;
     }
+
+    pl = &de->player;
+    pitch = fabs(pl->pitch * pl->sync_pitch);
+    if (pitch == 0.0) /* stopped, so use the nominal tempo */
+        pitch = 1.0;
+
+    selector_set_tempo(sel, de->record->bpm * pitch, TEMPO_TOLERANCE);
 }
 
 /*
@@ -1530,6 +2419,14 @@ static bool handle_key(SDLKey key, SDLMod mod)
 
             } else switch(func) {
             case FUNC_LOAD:
+                if (mod & KMOD_CTRL) {
+                    if (sel->bpm > 0.0)
+                        selector_set_tempo(sel, 0.0, 0.0);
+                    else
+                        select_tempo(sel, de);
+                    return true;
+                }
+
                 re = selector_current(sel);
                 if (re != NULL)
                     deck_load(de, re);
@@ -1577,6 +2474,10 @@ static SDL_Surface* set_size(int w, int h, struct rect *r)
 
     *r = shrink(rect(0, 0, w, h, scale), BORDER);
 
+    /* The display format may have changed */
+
+    text_cache_flush();
+
     fprintf(stderr, "New interface size is %dx%d.\n", w, h);
 
     return surface;
@@ -1600,7 +2501,38 @@ static void push_event(int t)
 static Uint32 ticker(Uint32 interval, void *p)
 {
     push_event(EVENT_TICKER);
-    return interval;
+    return __atomic_load_n(&refresh, __ATOMIC_RELAXED);
+}
+
+/*
+ * Choose when to draw the next frame, given the time taken to draw
+ * this one
+ *
+ * When nothing is moving there is little to see, so draw less often.
+ * Never spend more than the given share of the CPU drawing; this
+ * backs off if the drawing is slowed by other work on the machine.
+ */
+
+static void pace(double took, bool moving)
+{
+    unsigned int interval, least;
+
+    frame_count++;
+    frame_total += took;
+    if (took > frame_worst)
+        frame_worst = took;
+
+    frame_average += (took - frame_average) / 8;
+
+    interval = moving ? REFRESH : IDLE_REFRESH;
+
+    least = frame_average / cpu_share / 1000 + 1;
+    if (least > interval) {
+        interval = least;
+        frame_slowed++;
+    }
+
+    __atomic_store_n(&refresh, interval, __ATOMIC_RELAXED);
 }
 
 /*
@@ -1617,13 +2549,248 @@ static void defer_selector_redraw(struct observer *o, void *x)
     push_event(EVENT_SELECTOR);
 }
 
+/*
+ * Callback from a search thread; the result is collected by the
+ * interface thread
+ */
+
+static void defer_search_result(struct observer *o, void *x)
+{
+    push_event(EVENT_SEARCH);
+}
+
+/*
+ * Return: the current time, in microseconds
+ */
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        abort();
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * Release the rig lock, and account for the time for which it was
+ * held
+ *
+ * Pre: rig lock is held, and was taken at the given time
+ */
+
+static void release_rig(double locked)
+{
+    double held;
+
+    held = now_us() - locked;
+    rig_unlock();
+
+    lock_count++;
+    lock_total += held;
+
+    if (held > lock_worst) {
+        lock_worst = held;
+        if (held > LOCK_WARNING) {
+            fprintf(stderr, "Interface held the rig lock for %.0fus\n",
+                    held);
+        }
+    }
+}
+
+/*
+ * Take a copy of the visible rows of the selector
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ * Pre: rig lock is held
+ */
+
+static int snapshot_library(struct snapshot *sn, const struct selector *sel,
+                            unsigned int rows)
+{
+    unsigned int n;
+
+    if (rows > sn->size) {
+        struct crate_row *c;
+        struct record **r;
+
+        c = realloc(sn->crate, sizeof *c * rows);
+        if (c == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        sn->crate = c;
+
+        r = realloc(sn->record, sizeof *r * rows);
+        if (r == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        sn->record = r;
+
+        sn->size = rows;
+    }
+
+    strcpy(sn->search, sel->search);
+    sn->matches = sel->view_index->entries;
+    sn->bpm = sel->bpm;
+    sn->sort = sel->sort;
+    sn->crates = sel->crates;
+    sn->records = sel->records;
+    sn->rows = rows;
+
+    /* Crates and records are not freed until the library is cleared,
+     * so it is enough to keep a pointer */
+
+    for (n = 0; n < rows; n++) {
+        int c, r;
+
+        c = listbox_map(&sn->crates, n);
+        if (c != -1) {
+            const struct crate *crate;
+
+            crate = sel->library->crate[c];
+            sn->crate[n].name = crate->name;
+            sn->crate[n].is_fixed = crate->is_fixed;
+            sn->crate[n].is_busy = crate->is_busy;
+        }
+
+        r = listbox_map(&sn->records, n);
+        if (r != -1)
+            sn->record[n] = sel->view_index->record[r];
+    }
+
+    return 0;
+}
+
+/*
+ * Count the cue points in each division of the track, for the overview
+ *
+ * Pre: rig lock is held
+ */
+
+static void snapshot_markers(struct deck_snapshot *ds, const struct cues *q)
+{
+    size_t n;
+    double length;
+    bool changed;
+
+    length = (double)ds->track->length / ds->track->rate;
+    changed = false;
+
+    for (n = 0; n < OVERVIEW_MARKERS; n++) {
+        size_t count;
+
+        count = cues_count(q, length * n / OVERVIEW_MARKERS,
+                           length * (n + 1) / OVERVIEW_MARKERS);
+        if (count > UCHAR_MAX)
+            count = UCHAR_MAX;
+
+        if (ds->marker[n] != count) {
+            ds->marker[n] = count;
+            changed = true;
+        }
+    }
+
+    ds->markers_changed = changed;
+}
+
+/*
+ * Take a copy of the state of each deck; a reference is held on each
+ * track so that it cannot go away while being drawn
+ *
+ * Pre: rig lock is held
+ */
+
+static void snapshot_decks(struct snapshot *sn)
+{
+    size_t d;
+
+    sn->moving = false;
+
+    for (d = 0; d < ndeck; d++) {
+        struct deck_snapshot *ds;
+        struct player *pl;
+        struct timecoder *tc;
+        struct track *old;
+
+        ds = &sn->deck[d];
+        pl = &deck[d].player;
+
+        old = ds->track;
+        ds->track = pl->track;
+        track_acquire(ds->track);
+        if (old != NULL)
+            track_release(old);
+
+        if (ds->track != old || player_get_position(pl) != ds->position
+            || track_is_importing(ds->track))
+        {
+            sn->moving = true;
+        }
+
+        ds->record = deck[d].record;
+        ds->position = player_get_position(pl);
+        ds->elapsed = player_get_elapsed(pl);
+        ds->remain = player_get_remain(pl);
+
+        tc = &deck[d].timecoder;
+        ds->timecode = tc->def->name;
+        ds->timecode_position = timecoder_get_position(tc, NULL);
+        ds->rps = timecoder_revs_per_sec(tc);
+        ds->pitch = pl->pitch;
+        ds->sync_pitch = pl->sync_pitch;
+        ds->last_difference = pl->last_difference;
+        ds->timecode_control = pl->timecode_control;
+        ds->recalibrate = pl->recalibrate;
+        ds->locked = deck_is_locked(&deck[d]);
+        ds->scope_changed = timecoder_monitor_update(tc);
+
+        snapshot_markers(ds, &deck[d].cues);
+    }
+}
+
+/*
+ * Pre: rig lock is held
+ */
+
+static void snapshot_status(struct snapshot *sn)
+{
+    strncpy(sn->status, status(), sizeof sn->status - 1);
+    sn->status[sizeof sn->status - 1] = '\0';
+    sn->status_level = status_level();
+}
+
+/*
+ * Release the references held by the snapshot
+ *
+ * Pre: rig lock is held
+ */
+
+static void release_snapshot(struct snapshot *sn)
+{
+    size_t d;
+
+    for (d = 0; d < ndeck; d++) {
+        if (sn->deck[d].track != NULL) {
+            track_release(sn->deck[d].track);
+            sn->deck[d].track = NULL;
+        }
+    }
+}
+
 /*
  * The SDL interface thread
+ *
+ * The rig is locked only to handle each event and take a snapshot of
+ * what is to be drawn; the drawing itself is done without the lock.
  */
 
 static int interface_main(void)
 {
     bool library_update, decks_update, status_update;
+    double locked;
 
     SDL_Event event;
     SDL_TimerID timer;
@@ -1643,16 +2810,14 @@ static int interface_main(void)
 
     timer = SDL_AddTimer(REFRESH, ticker, NULL);
 
-    rig_lock();
-
     for (;;) {
-
-        rig_unlock();
+        unsigned int rows;
 
         if (SDL_WaitEvent(&event) < 0)
             break;
 
         rig_lock();
+        locked = now_us();
 
         switch(event.type) {
         case SDL_QUIT: /* user request to quit application; eg. window close */
@@ -1668,6 +2833,7 @@ static int interface_main(void)
             library_update = true;
             decks_update = true;
             status_update = true;
+            invalidate_decks();
 
             break;
 
@@ -1676,6 +2842,7 @@ static int interface_main(void)
             break;
 
         case EVENT_QUIT: /* internal request to finish this thread */
+            release_rig(locked);
             goto finish;
 
         case EVENT_STATUS:
@@ -1686,6 +2853,10 @@ static int interface_main(void)
             library_update = true;
             break;
 
+        case EVENT_SEARCH:
+            selector_collect(&selector);
+            break;
+
         case SDL_KEYDOWN:
             if (handle_key(event.key.keysym.sym, event.key.keysym.mod))
             {
@@ -1714,19 +2885,38 @@ static int interface_main(void)
         if (rplayers.h < 0 || rplayers.w < 0)
             decks_update = false;
 
-        if (!library_update && !decks_update && !status_update)
+        if (!library_update && !decks_update && !status_update) {
+            release_rig(locked);
             continue;
+        }
+
+        if (library_update) {
+            rows = library_rows(&rlibrary);
+            selector_set_lines(&selector, rows > 0 ? rows : 1);
+            if (snapshot_library(&snapshot, &selector, rows) == -1)
+                library_update = false;
+        }
+
+        if (status_update)
+            snapshot_status(&snapshot);
+
+        if (decks_update)
+            snapshot_decks(&snapshot);
+
+        release_rig(locked);
 
         LOCK(surface);
 
         if (library_update)
-            draw_library(surface, &rlibrary, &selector);
+            draw_library(surface, &rlibrary, &snapshot);
 
         if (status_update)
-            draw_status(surface, &rstatus);
+            draw_status(surface, &rstatus, &snapshot);
 
-        if (decks_update)
-            draw_decks(surface, &rplayers, deck, ndeck, meter_scale);
+        if (decks_update) {
+            draw_decks(surface, &rplayers, deck, snapshot.deck, ndeck,
+                       meter_scale);
+        }
 
         UNLOCK(surface);
 
@@ -1741,17 +2931,20 @@ static int interface_main(void)
         }
 
         if (decks_update) {
-            UPDATE(surface, &rplayers);
+            update_damage(surface, &rplayers);
+            pace(now_us() - locked, snapshot.moving);
             decks_update = false;
         }
 
     } /* main loop */
 
  finish:
-    rig_unlock();
-
     SDL_RemoveTimer(timer);
 
+    rig_lock();
+    release_snapshot(&snapshot);
+    rig_unlock();
+
     return 0;
 }
 
@@ -1846,7 +3039,8 @@ static int parse_geometry(const char *s)
  * error
  */
 
-int interface_start(struct library *lib, const char *geo, bool decor)
+int interface_start(struct library *lib, const char *geo, bool decor,
+                    int cpu)
 {
     size_t n;
 
@@ -1858,17 +3052,34 @@ int interface_start(struct library *lib, const char *geo, bool decor)
     if (!decor)
         video_flags |= SDL_NOFRAME;
 
+    cpu_share = cpu / 100.0;
+
     for (n = 0; n < ndeck; n++) {
         if (timecoder_monitor_init(&deck[n].timecoder, zoom(SCOPE_SIZE)) == -1)
             return -1;
     }
 
+    view = calloc(ndeck, sizeof *view);
+    if (view == NULL && ndeck > 0) {
+        perror("calloc");
+        return -1;
+    }
+
+    snapshot.deck = calloc(ndeck, sizeof *snapshot.deck);
+    if (snapshot.deck == NULL && ndeck > 0) {
+        perror("calloc");
+        return -1;
+    }
+
     if (init_spinner(zoom(SPINNER_SIZE)) == -1)
         return -1;
 
+    init_band_colours();
+
     selector_init(&selector, lib);
     watch(&on_status, &status_changed, defer_status_redraw);
     watch(&on_selector, &selector.changed, defer_selector_redraw);
+    watch(&on_search, &selector.searched, defer_search_result);
     status_set(STATUS_VERBOSE, banner);
 
     fprintf(stderr, "Initialising SDL...\n");
@@ -1890,6 +3101,8 @@ int interface_start(struct library *lib, const char *geo, bool decor)
     if (load_fonts() == -1)
         return -1;
 
+    text_cache_init();
+
     utf = iconv_open("UTF8", "");
     if (utf == (iconv_t)-1) {
         perror("iconv_open");
@@ -1912,20 +3125,42 @@ int interface_start(struct library *lib, const char *geo, bool decor)
 
 void interface_stop(void)
 {
-    size_t n;
-
     push_event(EVENT_QUIT);
 
     if (pthread_join(ph, NULL) != 0)
         abort();
 
-    for (n = 0; n < ndeck; n++)
-        timecoder_monitor_clear(&deck[n].timecoder);
+    /* The monitors are cleared with the decks, once the realtime
+     * thread has stopped plotting into them */
+
+    invalidate_decks();
+    free(view);
+
+    free(snapshot.deck);
+    free(snapshot.crate);
+    free(snapshot.record);
+
+    if (lock_count > 0) {
+        fprintf(stderr, "Interface held the rig lock for an average of "
+                "%.0fus, at most %.0fus\n",
+                lock_total / lock_count, lock_worst);
+    }
+
+    if (frame_count > 0) {
+        fprintf(stderr, "Interface drew %lu frames in an average of %.0fus, "
+                "at most %.0fus; %lu were slowed to stay within %.0f%% "
+                "of a CPU\n",
+                frame_count, frame_total / frame_count, frame_worst,
+                frame_slowed, cpu_share * 100);
+    }
 
     clear_spinner();
     ignore(&on_status);
     ignore(&on_selector);
+    selector_cancel(&selector);
+    ignore(&on_search);
     selector_clear(&selector);
+    text_cache_flush();
     clear_fonts();
 
     if (iconv_close(utf) == -1)
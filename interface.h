@@ -23,7 +23,8 @@
 #include "deck.h"
 #include "library.h"
 
-int interface_start(struct library *lib, const char *geo, bool decor);
+int interface_start(struct library *lib, const char *geo, bool decor,
+                    int cpu);
 void interface_stop();
 
 #endif
@@ -27,7 +27,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
+#include "dirwatch.h"
 #include "excrate.h"
 #include "external.h"
 
@@ -35,6 +38,17 @@
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
 
+/* A scan of part of a directory crate, to bring it up to date */
+
+struct update {
+    struct list crate;
+    struct crate *c;
+    char *path; /* given to the scan */
+    bool temporary; /* path is a playlist which we wrote */
+    struct excrate *excrate;
+    struct observer on_addition, on_completion;
+};
+
 /* The locale used for searches */
 
 static iconv_t ascii = (iconv_t)-1;
@@ -93,6 +107,9 @@ static int crate_init(struct crate *c, const char *name)
     }
 
     c->is_busy = false;
+    c->generation = 0;
+    c->dirwatch = NULL;
+    list_init(&c->updates);
 
     event_init(&c->activity);
     event_init(&c->refresh);
@@ -109,6 +126,7 @@ static int crate_init(struct crate *c, const char *name)
 static void propagate_addition(struct observer *o, void *x)
 {
     struct crate *c = container_of(o, struct crate, on_addition);
+    c->generation++;
     fire(&c->addition, x);
 }
 
@@ -136,6 +154,7 @@ static int crate_init_all(struct library *l, struct crate *c, const char *name)
 
     c->is_fixed = true;
     c->listing = &l->storage;
+    c->storage = &l->storage;
     watch(&c->on_addition, &c->listing->addition, propagate_addition);
     c->excrate = NULL;
 
@@ -155,6 +174,7 @@ static void hook_up_excrate(struct crate *c, struct excrate *e)
 
     c->excrate = e;
     c->listing = &e->listing;
+    c->generation++;
     fire(&c->refresh, NULL);
 
     watch(&c->on_addition, &c->listing->addition, propagate_addition);
@@ -162,59 +182,443 @@ static void hook_up_excrate(struct crate *c, struct excrate *e)
 }
 
 /*
- * Initialise a crate which has a fixed scan as its source
- *
- * Not all crates have a source (eg. 'all' crate.) This is also
- * convenient as in future there may be other sources such as virtual
- * crates or external searches.
+ * Re-run a crate which has a scan as its source
  *
- * Return: 0 on success or -1 on error
+ * Return: 0 on success, -1 on error
  */
 
-static int crate_init_scan(struct library *l, struct crate *c, const char *name,
-                           const char *scan, const char *path)
+static int crate_rescan(struct crate *c)
 {
     struct excrate *e;
 
-    if (crate_init(c, name) == -1)
-        return -1;
+    assert(c->excrate != NULL);
 
-    c->is_fixed = false;
-    c->scan = scan;
-    c->path = path;
+    /* Replace the excrate in-place. Care needed to re-wire
+     * everything back up again as before */
 
-    e = excrate_acquire_by_scan(scan, path, &l->storage);
+    e = excrate_acquire_by_scan(c->scan, c->path, c->storage);
     if (e == NULL)
         return -1;
 
+    ignore(&c->on_completion);
+    ignore(&c->on_addition);
+    excrate_release(c->excrate);
     hook_up_excrate(c, e);
 
     return 0;
 }
 
 /*
- * Re-run a crate which has a scan as its source
+ * An addition from the scan of a change; add it to the crate
+ */
+
+static void update_addition(struct observer *o, void *x)
+{
+    struct update *u = container_of(o, struct update, on_addition);
+    struct record *r = x;
+    struct index *l;
+    size_t n;
+
+    /* Scans of changes can overlap, so the record may already be
+     * here; it must not be added twice */
+
+    l = &u->c->listing->by_artist;
+    n = index_find(l, r, SORT_ARTIST);
+    if (n < l->entries && l->record[n] == r)
+        return;
+
+    /* If we're out of memory then silently drop it */
+
+    (void)listing_add(u->c->listing, r);
+}
+
+/*
+ * Finish with the scan of a change, terminating it if it is still
+ * running
+ */
+
+static void finish_update(struct update *u)
+{
+    ignore(&u->on_addition);
+    ignore(&u->on_completion);
+    excrate_release(u->excrate);
+
+    if (u->temporary && unlink(u->path) == -1)
+        perror("unlink");
+
+    list_del(&u->crate);
+    free(u->path);
+    free(u);
+}
+
+static void update_completion(struct observer *o, void *x)
+{
+    struct update *u = container_of(o, struct update, on_completion);
+    finish_update(u);
+}
+
+/*
+ * Scan the given path, and add the results to the crate
  *
- * Return: 0 on success, -1 on error
+ * Return: 0 on success or -1 on error
+ * Post: on success, responsibility for path is taken
+ */
+
+static int start_update(struct crate *c, char *path, bool temporary)
+{
+    struct update *u;
+
+    u = malloc(sizeof *u);
+    if (u == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    u->excrate = excrate_acquire_by_scan(c->scan, path, c->storage);
+    if (u->excrate == NULL) {
+        free(u);
+        return -1;
+    }
+
+    u->c = c;
+    u->path = path;
+    u->temporary = temporary;
+
+    watch(&u->on_addition, &u->excrate->listing.addition, update_addition);
+    watch(&u->on_completion, &u->excrate->completion, update_completion);
+    list_add(&u->crate, &c->updates);
+
+    return 0;
+}
+
+/*
+ * Write a playlist of the given files, for use by the scan
+ *
+ * Files which have since gone away are left out.
+ *
+ * Return: number of files written, or -1 on error
+ * Post: if files were written, *path is the playlist with
+ * responsibility
+ */
+
+static int write_playlist(const struct paths *p, char **path)
+{
+    int fd, count;
+    size_t n;
+    const char *tmp;
+    char *s;
+    FILE *f;
+
+    tmp = getenv("TMPDIR");
+    if (tmp == NULL)
+        tmp = "/tmp";
+
+    s = malloc(strlen(tmp) + sizeof "/xwax-XXXXXX");
+    if (s == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    sprintf(s, "%s/xwax-XXXXXX", tmp);
+
+    fd = mkstemp(s);
+    if (fd == -1) {
+        perror("mkstemp");
+        free(s);
+        return -1;
+    }
+
+    f = fdopen(fd, "w");
+    if (f == NULL) {
+        perror("fdopen");
+        if (close(fd) == -1)
+            abort();
+        goto fail;
+    }
+
+    count = 0;
+
+    for (n = 0; n < p->entries; n++) {
+        const char *x = p->path[n];
+
+        if (strchr(x, '\n') != NULL) /* not possible in a playlist */
+            continue;
+
+        if (access(x, F_OK) == -1)
+            continue;
+
+        fprintf(f, "%s\n", x);
+        count++;
+    }
+
+    if (fclose(f) != 0) {
+        perror("fclose");
+        goto fail;
+    }
+
+    if (count == 0)
+        goto fail;
+
+    *path = s;
+    return count;
+
+fail:
+    if (unlink(s) == -1)
+        perror("unlink");
+    free(s);
+    return count == 0 ? 0 : -1;
+}
+
+/*
+ * Comparison function, see qsort(3)
+ */
+
+static int pathcmp(const void *a, const void *b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+ * Return: true if the first len characters of the pathname are one
+ * of the given paths
+ * Pre: paths are sorted
+ */
+
+static bool is_listed(const char *pathname, size_t len,
+                      char **path, size_t n)
+{
+    size_t lo, hi;
+
+    lo = 0;
+    hi = n;
+
+    while (lo < hi) {
+        size_t mid;
+        int r;
+
+        mid = (lo + hi) / 2;
+
+        r = strncmp(pathname, path[mid], len);
+        if (r == 0 && path[mid][len] != '\0')
+            r = -1; /* a longer path sorts after */
+
+        if (r == 0)
+            return true;
+
+        if (r < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return false;
+}
+
+/*
+ * Return: true if the pathname is at, or within, one of the given
+ * paths
+ * Pre: paths are sorted
+ */
+
+static bool is_within_any(const char *pathname, char **path, size_t n)
+{
+    size_t len;
+
+    /* The pathname itself, then each directory above it */
+
+    len = strlen(pathname);
+
+    while (len > 0) {
+        if (is_listed(pathname, len, path, n))
+            return true;
+
+        do
+            len--;
+        while (len > 0 && pathname[len] != '/');
+    }
+
+    return false;
+}
+
+/*
+ * Remove the records at, or within, any of the paths from an index
+ *
+ * Return: number of records removed
+ * Pre: paths are sorted
  */
 
-static int crate_rescan(struct crate *c, struct library *l)
+static size_t filter(struct index *i, char **path, size_t n)
+{
+    size_t from, to, removed;
+
+    to = 0;
+    for (from = 0; from < i->entries; from++) {
+        struct record *r = i->record[from];
+
+        if (!is_within_any(r->pathname, path, n))
+            i->record[to++] = r;
+    }
+
+    removed = i->entries - to;
+    i->entries = to;
+
+    return removed;
+}
+
+/*
+ * Remove records at, or within, any of the given paths from the
+ * crate, in a single pass of each index
+ *
+ * The crate is refreshed as a whole, rather than for each record.
+ *
+ * Pre: paths are sorted
+ */
+
+static void remove_paths(struct crate *c, char **path, size_t n)
+{
+    struct listing *l = c->listing;
+
+    if (filter(&l->by_order, path, n) == 0)
+        return;
+
+    (void)filter(&l->by_artist, path, n);
+    (void)filter(&l->by_bpm, path, n);
+
+    c->generation++;
+    fire(&c->refresh, NULL);
+}
+
+/*
+ * Bring the crate up to date with changes to its directory, and
+ * only scan what has changed
+ *
+ * A file which is re-written is removed before it is scanned again,
+ * as its artist or title may have changed.
+ */
+
+static void handle_change(struct observer *o, void *x)
+{
+    struct crate *c = container_of(o, struct crate, on_change);
+    struct dirwatch *w = x;
+    size_t n, npaths;
+    char *s, **path;
+
+    npaths = w->removed.entries + w->files.entries;
+
+    if (npaths > 0) {
+        path = malloc(sizeof *path * npaths);
+        if (path == NULL) {
+            perror("malloc");
+
+            /* Each path on its own, at the cost of more passes */
+
+            for (n = 0; n < w->removed.entries; n++)
+                remove_paths(c, &w->removed.path[n], 1);
+            for (n = 0; n < w->files.entries; n++)
+                remove_paths(c, &w->files.path[n], 1);
+        } else {
+            memcpy(path, w->removed.path,
+                   sizeof *path * w->removed.entries);
+            memcpy(path + w->removed.entries, w->files.path,
+                   sizeof *path * w->files.entries);
+            qsort(path, npaths, sizeof *path, pathcmp);
+
+            remove_paths(c, path, npaths);
+            free(path);
+        }
+    }
+
+    if (write_playlist(&w->files, &s) > 0) {
+        if (start_update(c, s, true) == -1) {
+            if (unlink(s) == -1)
+                perror("unlink");
+            free(s);
+        }
+    }
+
+    for (n = 0; n < w->subdirs.entries; n++) {
+        s = strdup(w->subdirs.path[n]);
+        if (s == NULL) {
+            perror("strdup");
+            continue;
+        }
+
+        if (start_update(c, s, false) == -1)
+            free(s);
+    }
+}
+
+/*
+ * Changes to the directory have been lost, so scan it again
+ */
+
+static void handle_overflow(struct observer *o, void *x)
+{
+    struct crate *c = container_of(o, struct crate, on_overflow);
+    (void)crate_rescan(c);
+}
+
+/*
+ * Follow changes to a crate which is a directory, rather than
+ * needing to scan all of it again
+ *
+ * This is optional; on error the crate is left as it is.
+ */
+
+static void watch_directory(struct crate *c)
+{
+    struct stat st;
+    struct dirwatch *w;
+
+    if (stat(c->path, &st) == -1 || !S_ISDIR(st.st_mode))
+        return;
+
+    w = malloc(sizeof *w);
+    if (w == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    if (dirwatch_init(w, c->path) == -1) {
+        fprintf(stderr, "Changes to %s will not be followed\n", c->path);
+        free(w);
+        return;
+    }
+
+    watch(&c->on_change, &w->change, handle_change);
+    watch(&c->on_overflow, &w->overflow, handle_overflow);
+    c->dirwatch = w;
+}
+
+/*
+ * Initialise a crate which has a fixed scan as its source
+ *
+ * Not all crates have a source (eg. 'all' crate.) This is also
+ * convenient as in future there may be other sources such as virtual
+ * crates or external searches.
+ *
+ * Return: 0 on success or -1 on error
+ */
+
+static int crate_init_scan(struct library *l, struct crate *c, const char *name,
+                           const char *scan, const char *path)
 {
     struct excrate *e;
 
-    assert(c->excrate != NULL);
+    if (crate_init(c, name) == -1)
+        return -1;
 
-    /* Replace the excrate in-place. Care needed to re-wire
-     * everything back up again as before */
+    c->is_fixed = false;
+    c->scan = scan;
+    c->path = path;
+    c->storage = &l->storage;
 
-    e = excrate_acquire_by_scan(c->scan, c->path, &l->storage);
+    e = excrate_acquire_by_scan(scan, path, &l->storage);
     if (e == NULL)
         return -1;
 
-    ignore(&c->on_completion);
-    ignore(&c->on_addition);
-    excrate_release(c->excrate);
     hook_up_excrate(c, e);
+    watch_directory(c);
 
     return 0;
 }
@@ -228,8 +632,20 @@ static int crate_rescan(struct crate *c, struct library *l)
 
 static void crate_clear(struct crate *c)
 {
+    struct update *u, *x;
+
     ignore(&c->on_addition);
 
+    if (c->dirwatch != NULL) {
+        ignore(&c->on_change);
+        ignore(&c->on_overflow);
+        dirwatch_clear(c->dirwatch);
+        free(c->dirwatch);
+    }
+
+    list_for_each_safe(u, x, &c->updates, crate)
+        finish_update(u);
+
     if (c->excrate != NULL) {
         ignore(&c->on_completion);
         excrate_release(c->excrate);
@@ -292,6 +708,51 @@ struct record* listing_add(struct listing *l, struct record *r)
     return r;
 }
 
+/*
+ * Move a record to its place in order of tempo, after a change
+ *
+ * Return: true if the record is in the listing, otherwise false
+ */
+
+static bool resort(struct listing *l, struct record *r)
+{
+    if (!index_remove(&l->by_bpm, r, SORT_PLAYLIST)) /* by pointer */
+        return false;
+
+    (void)index_insert(&l->by_bpm, r, SORT_BPM); /* space was freed */
+    return true;
+}
+
+/*
+ * Set the tempo of a record, keeping every crate in order
+ *
+ * Pre: record is in the library
+ */
+
+void library_set_bpm(struct library *lib, struct record *r, double bpm)
+{
+    size_t n;
+    bool stored;
+
+    r->bpm = bpm;
+    stored = resort(&lib->storage, r);
+
+    for (n = 0; n < lib->crates; n++) {
+        struct crate *c = lib->crate[n];
+        bool changed;
+
+        if (c->listing == &lib->storage)
+            changed = stored;
+        else
+            changed = resort(c->listing, r);
+
+        if (changed) {
+            c->generation++;
+            fire(&c->refresh, NULL);
+        }
+    }
+}
+
 /*
  * Comparison function, see qsort(3)
  */
@@ -633,5 +1094,5 @@ int library_rescan(struct library *l, struct crate *c)
     if (!c->excrate)
         return -1;
     else
-        return crate_rescan(c, l);
+        return crate_rescan(c);
 }
@@ -38,14 +38,20 @@ struct listing {
 struct crate {
     bool is_fixed, is_busy;
     char *name;
-    struct listing *listing;
+    struct listing *listing, *storage;
     struct observer on_addition, on_completion;
     struct event activity, /* at the crate level, not the listing */
         refresh, addition;
+    unsigned int generation; /* incremented when the content changes */
 
     /* Optionally, the corresponding source */
     const char *scan, *path;
     struct excrate *excrate;
+
+    /* Optionally, changes to a directory are followed */
+    struct dirwatch *dirwatch;
+    struct observer on_change, on_overflow;
+    struct list updates; /* scans of the changes */
 };
 
 /* The complete music library, which consists of multiple crates */
@@ -70,5 +76,6 @@ struct record* get_record(char *line);
 
 int library_import(struct library *lib, const char *scan, const char *path);
 int library_rescan(struct library *l, struct crate *c);
+void library_set_bpm(struct library *lib, struct record *r, double bpm);
 
 #endif
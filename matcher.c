@@ -0,0 +1,409 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Background search of a record index
+ *
+ * The source index is divided into fixed size chunks, which the
+ * worker threads take in turn. The results of each chunk are joined
+ * back together in order, so the result is identical to that of
+ * index_match().
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "matcher.h"
+
+#define CHUNK 4096 /* records per unit of work */
+#define CANCEL_EVERY 256 /* records between checks for cancellation */
+
+#define MIN(x,y) ((x)<(y)?(x):(y))
+
+/*
+ * Return: true if the job of the given generation is no longer wanted
+ */
+
+static bool cancelled(struct matcher *m, unsigned int generation)
+{
+    return __atomic_load_n(&m->generation, __ATOMIC_RELAXED) != generation;
+}
+
+/*
+ * Search a single chunk of the source, outside of the lock
+ *
+ * On memory allocation failure the chunk result is incomplete, in
+ * the same way as index_match().
+ *
+ * Return: -1 if the job was cancelled, otherwise 0
+ */
+
+static int match_chunk(struct matcher *m, size_t n, unsigned int generation)
+{
+    size_t i, end;
+    struct index *dest;
+
+    dest = &m->chunk[n];
+    index_blank(dest);
+
+    end = MIN((n + 1) * CHUNK, m->source.entries);
+
+    for (i = n * CHUNK; i < end; i++) {
+        struct record *re;
+
+        if (i % CANCEL_EVERY == 0 && cancelled(m, generation))
+            return -1;
+
+        re = m->source.record[i];
+        if (!record_match(re, &m->match))
+            continue;
+
+        if (index_reserve(dest, 1) == -1)
+            break;
+        index_add(dest, re);
+    }
+
+    return 0;
+}
+
+/*
+ * Join the results of every chunk, in order
+ *
+ * Pre: lock is held
+ * Post: on memory allocation failure the result is incomplete
+ */
+
+static void assemble(struct matcher *m)
+{
+    size_t n, i, total;
+
+    total = 0;
+    for (n = 0; n < m->chunks; n++)
+        total += m->chunk[n].entries;
+
+    index_blank(&m->result);
+    if (index_reserve(&m->result, total) == -1)
+        return;
+
+    for (n = 0; n < m->chunks; n++) {
+        for (i = 0; i < m->chunk[n].entries; i++)
+            index_add(&m->result, m->chunk[n].record[i]);
+    }
+}
+
+static void* worker(void *p)
+{
+    struct matcher *m = p;
+
+    mutex_lock(&m->lock);
+
+    for (;;) {
+        unsigned int generation;
+        size_t n;
+        int r;
+
+        while (!m->quit && m->next == m->chunks)
+            pthread_cond_wait(&m->work, &m->lock);
+
+        if (m->quit)
+            break;
+
+        generation = m->generation;
+        n = m->next++;
+        m->busy++;
+
+        mutex_unlock(&m->lock);
+        r = match_chunk(m, n, generation);
+        mutex_lock(&m->lock);
+
+        if (r == 0 && generation == m->generation
+            && ++m->done == m->chunks)
+        {
+            assemble(m);
+            m->ready = true;
+
+            /* Remain busy until the notification is done, so that a
+             * cancel guarantees there are no more notifications */
+
+            mutex_unlock(&m->lock);
+            fire(&m->completion, NULL);
+            mutex_lock(&m->lock);
+        }
+
+        if (--m->busy == 0)
+            pthread_cond_broadcast(&m->idle);
+    }
+
+    mutex_unlock(&m->lock);
+
+    return NULL;
+}
+
+/*
+ * Ask the workers to finish and wait for them
+ */
+
+static void stop_workers(struct matcher *m)
+{
+    size_t n;
+
+    mutex_lock(&m->lock);
+    m->quit = true;
+    pthread_cond_broadcast(&m->work);
+    mutex_unlock(&m->lock);
+
+    for (n = 0; n < m->nthreads; n++) {
+        if (pthread_join(m->thread[n], NULL) != 0)
+            abort();
+    }
+
+    m->nthreads = 0;
+}
+
+/*
+ * Initialise the matcher, and start a worker thread for each
+ * available processor
+ *
+ * Return: 0 on success or -1 if the threads could not be started
+ * Post: matcher is initialised, even if no threads were started
+ */
+
+int matcher_init(struct matcher *m)
+{
+    long ncpu;
+    size_t n, want;
+
+    mutex_init(&m->lock);
+    if (pthread_cond_init(&m->work, NULL) != 0)
+        abort();
+    if (pthread_cond_init(&m->idle, NULL) != 0)
+        abort();
+
+    m->quit = false;
+    m->generation = 0;
+    m->chunks = 0;
+    m->next = 0;
+    m->done = 0;
+    m->busy = 0;
+    m->chunk = NULL;
+    m->nchunk = 0;
+    m->ready = false;
+    index_init(&m->source);
+    index_init(&m->result);
+    event_init(&m->completion);
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1)
+        ncpu = 1;
+    want = MIN(ncpu, MATCHER_MAX_THREADS);
+
+    m->nthreads = 0;
+
+    for (n = 0; n < want; n++) {
+        int r;
+
+        r = pthread_create(&m->thread[n], NULL, worker, m);
+        if (r != 0) {
+            errno = r;
+            perror("pthread_create");
+            stop_workers(m); /* remains usable, but with no threads */
+            return -1;
+        }
+
+        m->nthreads++;
+    }
+
+    return 0;
+}
+
+/*
+ * Pre: no observers are watching the completion event
+ */
+
+void matcher_clear(struct matcher *m)
+{
+    size_t n;
+
+    if (m->nthreads > 0)
+        stop_workers(m);
+
+    for (n = 0; n < m->nchunk; n++)
+        index_clear(&m->chunk[n]);
+    free(m->chunk);
+
+    index_clear(&m->source);
+    index_clear(&m->result);
+    event_clear(&m->completion);
+
+    if (pthread_cond_destroy(&m->idle) != 0)
+        abort();
+    if (pthread_cond_destroy(&m->work) != 0)
+        abort();
+    mutex_clear(&m->lock);
+}
+
+/*
+ * Abandon any job in progress, and wait for the workers to do so
+ *
+ * Pre: lock is held
+ * Post: no worker is using the job, or will notify of its completion
+ */
+
+static void quiesce(struct matcher *m)
+{
+    __atomic_add_fetch(&m->generation, 1, __ATOMIC_RELAXED);
+    m->chunks = 0;
+    m->next = 0;
+    m->ready = false;
+
+    while (m->busy > 0)
+        pthread_cond_wait(&m->idle, &m->lock);
+}
+
+/*
+ * Make sure there is a result index for every chunk of the job
+ *
+ * Return: 0 on success or -1 on memory allocation failure
+ */
+
+static int enough_chunks(struct matcher *m, size_t chunks)
+{
+    size_t n;
+    struct index *c;
+
+    if (chunks <= m->nchunk)
+        return 0;
+
+    c = realloc(m->chunk, sizeof(struct index) * chunks);
+    if (c == NULL) {
+        perror("realloc");
+        return -1;
+    }
+
+    for (n = m->nchunk; n < chunks; n++)
+        index_init(&c[n]);
+
+    m->chunk = c;
+    m->nchunk = chunks;
+
+    return 0;
+}
+
+/*
+ * Start a search of the source index in the background, cancelling
+ * any search which is already in progress
+ *
+ * The source is copied, so the caller is free to modify it once this
+ * function returns. The completion event is fired from a worker
+ * thread once the result is ready for matcher_collect().
+ *
+ * Return: 0 on success, or -1 if the search could not be started
+ */
+
+int matcher_submit(struct matcher *m, const struct index *src,
+                   const struct match *match)
+{
+    size_t chunks;
+
+    if (m->nthreads == 0)
+        return -1;
+
+    mutex_lock(&m->lock);
+
+    quiesce(m);
+
+    if (index_copy(src, &m->source) == -1)
+        goto fail;
+
+    chunks = (src->entries + CHUNK - 1) / CHUNK;
+    if (chunks == 0)
+        chunks = 1;
+
+    if (enough_chunks(m, chunks) == -1)
+        goto fail;
+
+    match_copy(&m->match, match);
+
+    m->done = 0;
+    m->next = 0;
+    m->chunks = chunks;
+    pthread_cond_broadcast(&m->work);
+
+    mutex_unlock(&m->lock);
+
+    return 0;
+
+fail:
+    mutex_unlock(&m->lock);
+    return -1;
+}
+
+/*
+ * Cancel any search in progress
+ *
+ * Post: there are no further completion events until the next job
+ */
+
+void matcher_cancel(struct matcher *m)
+{
+    if (m->nthreads == 0)
+        return;
+
+    mutex_lock(&m->lock);
+    quiesce(m);
+    mutex_unlock(&m->lock);
+}
+
+/*
+ * Take the result of a completed search
+ *
+ * The indexes are exchanged, rather than copied, and so the previous
+ * content of dest is lost.
+ *
+ * Return: true if a result was collected, otherwise false
+ */
+
+bool matcher_collect(struct matcher *m, struct index *dest)
+{
+    bool r;
+
+    if (m->nthreads == 0)
+        return false;
+
+    mutex_lock(&m->lock);
+
+    r = m->ready;
+    if (r) {
+        struct index tmp;
+
+        tmp = *dest;
+        *dest = m->result;
+        m->result = tmp;
+
+        m->ready = false;
+    }
+
+    mutex_unlock(&m->lock);
+
+    return r;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Search of an index in the background, split across worker threads
+ */
+
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "index.h"
+#include "mutex.h"
+#include "observer.h"
+
+#define MATCHER_MAX_THREADS 4
+
+struct matcher {
+    pthread_t thread[MATCHER_MAX_THREADS];
+    size_t nthreads;
+
+    mutex lock;
+    pthread_cond_t work, idle;
+    bool quit;
+
+    /* The current job; submitting a new job cancels the last */
+
+    unsigned int generation;
+    struct index source; /* private copy, as the original may change */
+    struct match match;
+    size_t chunks, next, done, busy;
+    struct index *chunk; /* results, one per chunk */
+    size_t nchunk;
+
+    /* Completed result, ready to be collected */
+
+    bool ready;
+    struct index result;
+
+    struct event completion; /* fired from a worker thread */
+};
+
+int matcher_init(struct matcher *m);
+void matcher_clear(struct matcher *m);
+
+int matcher_submit(struct matcher *m, const struct index *src,
+                   const struct match *match);
+void matcher_cancel(struct matcher *m);
+bool matcher_collect(struct matcher *m, struct index *dest);
+
+#endif
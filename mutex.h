@@ -24,6 +24,11 @@
 #ifndef MUTEX_H
 #define MUTEX_H
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "realtime.h"
 
 typedef pthread_mutex_t mutex;
@@ -80,13 +80,15 @@ static inline void ignore(struct observer *observer)
 
 /*
  * Call the callback in all slots which are watching the given event
+ *
+ * An observer may ignore the event from within its own callback.
  */
 
 static inline void fire(struct event *s, void *data)
 {
-    struct observer *t;
+    struct observer *t, *x;
 
-    list_for_each(t, &s->observers, event) {
+    list_for_each_safe(t, x, &s->observers, event) {
         assert(t->func != NULL);
         t->func(t, data);
     }
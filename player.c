@@ -131,7 +131,7 @@ static double build_pcm(signed short *pcm, unsigned samples, double sample_dt,
         sa--;
 
         for (q = 0; q < 4; q++, sa++) {
-            if (sa < 0 || sa >= tr->length) {
+            if (!track_is_filled(tr, sa)) {
                 for (c = 0; c < PLAYER_CHANNELS; c++)
                     i[c][q] = 0;
             } else {
@@ -415,6 +415,23 @@ void retarget(struct player *pl)
     }
 }
 
+/*
+ * Ask for the audio at the given position to be imported ahead of
+ * the rest of the track
+ *
+ * This is safe from the realtime thread. The request is dropped if
+ * the track is being changed at the same time.
+ */
+
+void player_import_ahead(struct player *pl, double seconds)
+{
+    if (!spin_try_lock(&pl->lock))
+        return;
+
+    track_want_ahead(pl->track, seconds);
+    spin_unlock(&pl->lock);
+}
+
 /*
  * Seek to the given position
  */
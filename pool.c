@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * A pool of long-lived importer processes
+ *
+ * An importer run with the argument "--worker" takes requests on
+ * standard input, one at a time. Each request is two lines:
+ *
+ *   <id> <fifo> <rate> <start>
+ *   <path>
+ *
+ * where <start> is the position in seconds, or "-" for the start of
+ * the track. The audio is written to the named pipe <fifo>, which is
+ * then closed, and the line "<id> <status>" is written to standard
+ * output, where <status> is zero on success.
+ *
+ * A request is cancelled by removing the named pipe and closing it,
+ * so that the importer refuses it, or gets an error when it next
+ * writes audio. The importer must not create a file in place of a
+ * pipe which has gone, nor wait to open one which has no reader.
+ */
+
+#define _GNU_SOURCE /* asprintf() */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "debug.h"
+#include "external.h"
+#include "pool.h"
+
+#define MAX_WORKERS 32
+
+static unsigned int workers_per_importer; /* or zero for none */
+static struct worker worker[MAX_WORKERS];
+static size_t nworkers;
+static unsigned int next_id;
+
+static char *dir; /* for the named pipes */
+
+/*
+ * Request that up to the given number of importer processes are kept
+ * running for each importer
+ */
+
+void pool_use_workers(unsigned int n)
+{
+    workers_per_importer = n;
+}
+
+/*
+ * Create the directory for named pipes, if it does not already
+ * exist
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int make_dir(void)
+{
+    const char *tmp;
+
+    if (dir != NULL)
+        return 0;
+
+    tmp = getenv("TMPDIR");
+    if (tmp == NULL)
+        tmp = "/tmp";
+
+    if (asprintf(&dir, "%s/xwax-XXXXXX", tmp) == -1) {
+        perror("asprintf");
+        dir = NULL;
+        return -1;
+    }
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        free(dir);
+        dir = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Remove the named pipe, or whatever a worker left in its place, and
+ * forget its name
+ */
+
+static void remove_fifo(struct worker *w)
+{
+    if (w->fifo == NULL)
+        return;
+
+    if (unlink(w->fifo) == -1 && errno != ENOENT)
+        perror("unlink");
+
+    free(w->fifo);
+    w->fifo = NULL;
+}
+
+/*
+ * Return: 0 on success, or -1 on error
+ */
+
+static int start_worker(struct worker *w, const char *importer)
+{
+    pid_t pid;
+
+    pid = fork_socket(&w->fd, importer, "import", "--worker", NULL);
+    if (pid == -1)
+        return -1;
+
+    make_background(pid);
+
+    debug("importer worker %d for %s", pid, importer);
+
+    w->importer = importer;
+    w->pid = pid;
+    w->busy = false;
+    w->fifo = NULL;
+
+    return 0;
+}
+
+/*
+ * Stop a worker, for which the slot can then be used again
+ */
+
+static void stop_worker(struct worker *w)
+{
+    assert(w->pid != 0);
+
+    if (close(w->fd) == -1)
+        abort();
+
+    /* Once the socket is closed, an idle worker exits by itself */
+
+    if (w->busy && kill(w->pid, SIGTERM) == -1 && errno != ESRCH)
+        abort();
+
+    if (waitpid(w->pid, NULL, 0) == -1)
+        abort();
+
+    remove_fifo(w);
+    w->pid = 0;
+}
+
+/*
+ * Stop all the workers, and remove the directory of named pipes
+ */
+
+void pool_clear(void)
+{
+    size_t n;
+
+    for (n = 0; n < nworkers; n++) {
+        if (worker[n].pid != 0)
+            stop_worker(&worker[n]);
+    }
+
+    nworkers = 0;
+
+    if (dir != NULL) {
+        if (rmdir(dir) == -1)
+            perror("rmdir");
+        free(dir);
+        dir = NULL;
+    }
+}
+
+/*
+ * Find a worker which is free to take a request, starting one if
+ * there is room for it
+ *
+ * Return: pointer to worker, or NULL if none is available
+ */
+
+static struct worker* get_worker(const char *importer)
+{
+    size_t n;
+    unsigned int busy;
+    struct worker *spare;
+
+    busy = 0;
+    spare = NULL;
+
+    for (n = 0; n < nworkers; n++) {
+        struct worker *w = &worker[n];
+
+        if (w->pid == 0) {
+            if (spare == NULL)
+                spare = w;
+            continue;
+        }
+
+        if (strcmp(w->importer, importer) != 0)
+            continue;
+
+        if (!w->busy)
+            return w;
+
+        busy++;
+    }
+
+    if (busy >= workers_per_importer)
+        return NULL;
+
+    if (spare == NULL) {
+        if (nworkers == MAX_WORKERS)
+            return NULL;
+        spare = &worker[nworkers++];
+    }
+
+    if (start_worker(spare, importer) == -1)
+        return NULL;
+
+    return spare;
+}
+
+/*
+ * Send a request to a worker
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int send_request(struct worker *w, unsigned int id, const char *path,
+                        const char *rate, const char *start)
+{
+    char *s;
+    size_t len, done;
+
+    if (asprintf(&s, "%u %s %s %s\n%s\n", id, w->fifo, rate,
+                 start == NULL ? "-" : start, path) == -1)
+    {
+        perror("asprintf");
+        return -1;
+    }
+
+    len = strlen(s);
+
+    /* Don't die of SIGPIPE if the worker has gone away */
+
+    for (done = 0; done < len;) {
+        ssize_t z;
+
+        z = send(w->fd, s + done, len - done, MSG_NOSIGNAL);
+        if (z == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("send");
+            free(s);
+            return -1;
+        }
+
+        done += z;
+    }
+
+    free(s);
+    return 0;
+}
+
+/*
+ * Import a file using one of the workers
+ *
+ * The start position is given in seconds, or NULL for the start of
+ * the track.
+ *
+ * Return: pointer to worker, or NULL if no worker could be used
+ * Post: if not NULL, *fd is a non-blocking file descriptor for reading
+ */
+
+struct worker* pool_import(int *fd, const char *importer, const char *path,
+                           const char *rate, const char *start)
+{
+    int f;
+    unsigned int id;
+    struct worker *w;
+
+    if (workers_per_importer == 0)
+        return NULL;
+
+    if (strchr(path, '\n') != NULL) /* not possible in a request */
+        return NULL;
+
+    if (make_dir() == -1)
+        return NULL;
+
+    w = get_worker(importer);
+    if (w == NULL)
+        return NULL;
+
+    id = next_id++;
+
+    if (asprintf(&w->fifo, "%s/%u", dir, id) == -1) {
+        perror("asprintf");
+        w->fifo = NULL;
+        return NULL;
+    }
+
+    if (mkfifo(w->fifo, 0600) == -1) {
+        perror("mkfifo");
+        free(w->fifo);
+        w->fifo = NULL;
+        return NULL;
+    }
+
+    /* Open our end first, so that the worker does not wait when it
+     * opens the other */
+
+    f = open(w->fifo, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (f == -1) {
+        perror("open");
+        remove_fifo(w);
+        return NULL;
+    }
+
+    if (send_request(w, id, path, rate, start) == -1) {
+        if (close(f) == -1)
+            abort();
+        stop_worker(w);
+        return NULL;
+    }
+
+    w->busy = true;
+    w->id = id;
+
+    *fd = f;
+    return w;
+}
+
+/*
+ * Cancel the request in progress
+ *
+ * The named pipe is removed before it is closed, so that a worker
+ * which has not yet opened it fails to, rather than waiting forever.
+ * Its name is kept until the worker is done with the request, in
+ * case a file is created in its place.
+ *
+ * Post: fd is closed
+ */
+
+void worker_cancel(struct worker *w, int fd)
+{
+    assert(w->busy);
+
+    if (unlink(w->fifo) == -1)
+        perror("unlink");
+
+    if (close(fd) == -1)
+        abort();
+}
+
+/*
+ * Wait for the worker to complete the request in progress
+ *
+ * Return: exit status of the request, or -1 if the worker failed
+ * Pre: if the request was not cancelled, fd is its file descriptor
+ * Post: worker is free to take another request
+ */
+
+int worker_wait(struct worker *w, int fd)
+{
+    char line[64];
+    size_t len;
+    unsigned int id;
+    int status;
+
+    assert(w->busy);
+
+    if (fd != -1 && close(fd) == -1)
+        abort();
+
+    len = 0;
+
+    for (;;) {
+        ssize_t z;
+
+        z = read(w->fd, line + len, 1);
+        if (z == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            goto fail;
+        }
+
+        if (z == 0) {
+            fprintf(stderr, "Importer worker %d exited\n", w->pid);
+            goto fail;
+        }
+
+        if (line[len] == '\n')
+            break;
+
+        if (++len == sizeof line)
+            goto garbled;
+    }
+
+    line[len] = '\0';
+
+    if (sscanf(line, "%u %d", &id, &status) != 2 || id != w->id)
+        goto garbled;
+
+    /* Only now is the worker done with the name */
+
+    remove_fifo(w);
+    w->busy = false;
+    return status;
+
+garbled:
+    fprintf(stderr, "Importer worker %d sent garbled status\n", w->pid);
+fail:
+    stop_worker(w);
+    return -1;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * A long-lived importer process, which takes one request at a time
+ */
+
+struct worker {
+    const char *importer;
+    pid_t pid;
+    int fd; /* socket for requests, and their status */
+
+    /* The request in progress */
+
+    bool busy;
+    unsigned int id;
+    char *fifo; /* pathname the audio is written to */
+};
+
+void pool_use_workers(unsigned int n);
+void pool_clear(void);
+
+struct worker* pool_import(int *fd, const char *importer, const char *path,
+                           const char *rate, const char *start);
+
+void worker_cancel(struct worker *w, int fd);
+int worker_wait(struct worker *w, int fd);
+
+#endif
@@ -17,10 +17,13 @@
  *
  */
 
+#define _GNU_SOURCE /* sched_setaffinity() */
 #include <assert.h>
 #include <errno.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "controller.h"
 #include "debug.h"
@@ -64,6 +67,33 @@ static int raise_priority(int priority)
     return 0;
 }
 
+/*
+ * Bind the current thread to the last CPU, so that other work can be
+ * kept away from it
+ *
+ * Return: CPU number, or -1 if the thread is not bound
+ */
+
+static int bind_cpu(void)
+{
+    long cpus;
+    cpu_set_t set;
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 2 || cpus > CPU_SETSIZE)
+        return -1;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpus - 1, &set);
+
+    if (sched_setaffinity(0, sizeof set, &set) == -1) {
+        perror("sched_setaffinity");
+        return -1;
+    }
+
+    return cpus - 1;
+}
+
 /*
  * The realtime thread
  */
@@ -80,6 +110,8 @@ static void rt_main(struct rt *rt)
     if (rt->priority != 0) {
         if (raise_priority(rt->priority) == -1)
             rt->finished = true;
+        else
+            rt->cpu = bind_cpu();
     }
 
     if (sem_post(&rt->sem) == -1)
@@ -119,6 +151,7 @@ void rt_init(struct rt *rt)
     debug("%p", rt);
 
     rt->finished = false;
+    rt->cpu = -1;
     rt->ndv = 0;
     rt->nctl = 0;
     rt->npt = 0;
@@ -34,7 +34,8 @@ struct rt {
     pthread_t ph;
     sem_t sem;
     bool finished;
-    int priority;
+    int priority,
+        cpu; /* the thread is bound to, or -1 */
 
     size_t ndv;
     struct device *dv[3];
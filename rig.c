@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <sys/poll.h>
 
+#include "beat.h"
 #include "list.h"
 #include "mutex.h"
 #include "realtime.h"
@@ -39,7 +40,8 @@
 static int event[2]; /* pipe to wake up service thread */
 static struct list tracks = LIST_INIT(tracks),
     cuess = LIST_INIT(cuess),
-    excrates = LIST_INIT(excrates);
+    excrates = LIST_INIT(excrates),
+    dirwatches = LIST_INIT(dirwatches);
 mutex lock;
 
 int rig_init()
@@ -90,7 +92,7 @@ void rig_clear()
 
 int rig_main()
 {
-    struct pollfd pt[4];
+    struct pollfd pt[32];
     const struct pollfd *px = pt + ARRAY_SIZE(pt);
 
     /* Monitor event pipe from external threads */
@@ -107,32 +109,49 @@ int rig_main()
         struct track *track, *xtrack;
         struct excrate *excrate, *xexcrate;
         struct cues *cues, *xcues;
+        struct dirwatch *dirwatch;
 
         pe = &pt[1];
 
-        /* Do our best if we run out of poll entries */
+        /* Do our best if we run out of poll entries; anything left
+         * without one must not look at an entry from a previous pass */
 
         list_for_each(track, &tracks, rig) {
-            if (pe == px)
-                break;
-            track_pollfd(track, pe);
-            pe++;
+            if (px - pe < 2) { /* a track may use two */
+                track->import.pe = NULL;
+                track->ahead.pe = NULL;
+                continue;
+            }
+            pe += track_pollfd(track, pe);
         }
 
         list_for_each(excrate, &excrates, rig) {
-            if (pe == px)
-                break;
+            if (pe == px) {
+                excrate->pe = NULL;
+                continue;
+            }
             excrate_pollfd(excrate, pe);
             pe++;
         }
 
         list_for_each(cues, &cuess, rig) {
-            if (pe == px)
-                break;
+            if (pe == px) {
+                cues->pe = NULL;
+                continue;
+            }
             cues_pollfd(cues, pe);
             pe++;
         }
 
+        list_for_each(dirwatch, &dirwatches, rig) {
+            if (pe == px) {
+                dirwatch->pe = NULL;
+                continue;
+            }
+            dirwatch_pollfd(dirwatch, pe);
+            pe++;
+        }
+
         mutex_unlock(&lock);
 
         r = poll(pt, pe - pt, -1);
@@ -186,6 +205,11 @@ int rig_main()
 
         list_for_each_safe(cues, xcues, &cuess, rig)
             cues_handle(cues);
+
+        list_for_each(dirwatch, &dirwatches, rig)
+            dirwatch_handle(dirwatch);
+
+        beat_handle();
     }
  finish:
 
@@ -227,6 +251,15 @@ void rig_unlock(void)
     mutex_unlock(&lock);
 }
 
+/*
+ * Wake the rig, so that it polls on any new file descriptors
+ */
+
+void rig_wake(void)
+{
+    post_event(EVENT_WAKE);
+}
+
 /*
  * Add a track to be handled until import has completed
  */
@@ -251,3 +284,13 @@ void rig_post_cues(struct cues *q)
     list_add(&q->rig, &cuess);
     post_event(EVENT_WAKE);
 }
+
+/*
+ * Add a directory to be watched until dirwatch_clear()
+ */
+
+void rig_post_dirwatch(struct dirwatch *w)
+{
+    list_add(&w->rig, &dirwatches);
+    post_event(EVENT_WAKE);
+}
@@ -20,6 +20,7 @@
 #ifndef RIG_H
 #define RIG_H
 
+#include "dirwatch.h"
 #include "excrate.h"
 #include "track.h"
 #include "cues.h"
@@ -33,9 +34,11 @@ int rig_quit();
 
 void rig_lock();
 void rig_unlock();
+void rig_wake(void);
 
 void rig_post_track(struct track *t);
 void rig_post_excrate(struct excrate *e);
 void rig_post_cues(struct cues *q);
+void rig_post_dirwatch(struct dirwatch *w);
 
 #endif
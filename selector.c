@@ -19,10 +19,17 @@
  */
 
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "selector.h"
 
+/* Searches of an index of this size or larger are done by the
+ * background threads, to keep the interface responsive */
+
+#define BACKGROUND_SEARCH 16384
+
 /*
  * Scroll to our target entry if it can be found, otherwise leave our
  * position unchanged
@@ -130,6 +137,225 @@ static void notify(struct selector *s)
     fire(&s->changed, NULL);
 }
 
+/*
+ * Compile the search for the first len characters of the search
+ * string
+ */
+
+static void compile_prefix(struct selector *sel, struct match *m,
+                           size_t len)
+{
+    char prefix[sizeof sel->search];
+
+    assert(len <= sel->search_len);
+
+    memcpy(prefix, sel->search, len);
+    prefix[len] = '\0';
+    match_compile(m, prefix);
+}
+
+/*
+ * Start again from the entire crate, or the records of a compatible
+ * tempo, discarding every level which was based on it
+ */
+
+static void reset_levels(struct selector *sel)
+{
+    struct level *l;
+
+    l = &sel->level[0];
+    l->len = 0;
+    match_compile(&l->match, "");
+
+    if (sel->bpm > 0.0) {
+        assert(sel->sort == SORT_BPM);
+        (void)index_match_tempo(initial(sel), &l->index, &sel->tempo,
+                                &l->match);
+    } else {
+        (void)index_copy(initial(sel), &l->index);
+    }
+
+    sel->levels = 1;
+    sel->view_index = &l->index;
+}
+
+/*
+ * Use the swap index as the new last level, the result of searching
+ * for the given length of prefix
+ *
+ * If there are already too many levels, the last is replaced.
+ */
+
+static void push_level(struct selector *sel, size_t len)
+{
+    struct level *l;
+    struct index tmp;
+
+    assert(sel->levels > 0);
+    assert(len > sel->level[sel->levels - 1].len);
+
+    if (sel->levels == SELECTOR_LEVELS)
+        sel->levels--;
+
+    l = &sel->level[sel->levels++];
+    l->len = len;
+    compile_prefix(sel, &l->match, len);
+
+    tmp = l->index;
+    l->index = sel->swap_index;
+    sel->swap_index = tmp;
+
+    sel->view_index = &l->index;
+}
+
+/*
+ * Discard the levels for any prefix longer than the given length
+ */
+
+static void pop_levels(struct selector *sel, size_t len)
+{
+    while (sel->levels > 1 && sel->level[sel->levels - 1].len > len)
+        sel->levels--;
+
+    sel->view_index = &sel->level[sel->levels - 1].index;
+}
+
+/*
+ * Put the last level aside, so that it can be used again if we
+ * return to this crate and order with the same search and tempo
+ *
+ * The level is moved, not copied, and is removed from the view.
+ */
+
+static void memo_store(struct selector *sel)
+{
+    size_t n;
+    struct crate *c;
+    struct level *l;
+    struct memo *m;
+    struct index tmp;
+
+    l = &sel->level[sel->levels - 1];
+    if (l->len == 0)
+        return; /* the entire crate; nothing to be saved */
+
+    c = current_crate(sel);
+
+    /* Keep only the latest result for each crate and order */
+
+    for (n = 0; n < SELECTOR_MEMO; n++) {
+        m = &sel->memo[n];
+        if (m->crate == c && m->sort == sel->sort)
+            break;
+    }
+
+    if (n == SELECTOR_MEMO) {
+        m = &sel->memo[sel->next_memo];
+        sel->next_memo = (sel->next_memo + 1) % SELECTOR_MEMO;
+    }
+
+    m->crate = c;
+    m->generation = c->generation;
+    m->sort = sel->sort;
+    m->bpm = sel->bpm;
+    m->tolerance = sel->tolerance;
+    m->len = l->len;
+    memcpy(m->search, sel->search, l->len);
+    m->search[l->len] = '\0';
+
+    tmp = m->index;
+    m->index = l->index;
+    l->index = tmp;
+
+    pop_levels(sel, l->len - 1);
+}
+
+/*
+ * Take back a result which was put aside for the current crate and
+ * order, if the crate is unchanged and it is for a prefix of the
+ * search
+ *
+ * Pre: the only level is the entire crate
+ */
+
+static void memo_fetch(struct selector *sel)
+{
+    size_t n;
+    struct crate *c;
+
+    assert(sel->levels == 1);
+
+    c = current_crate(sel);
+
+    for (n = 0; n < SELECTOR_MEMO; n++) {
+        struct memo *m;
+        struct index tmp;
+
+        m = &sel->memo[n];
+
+        if (m->crate != c || m->sort != sel->sort)
+            continue;
+
+        if (m->bpm != sel->bpm || m->tolerance != sel->tolerance)
+            continue;
+
+        if (m->generation != c->generation || m->len > sel->search_len)
+            continue;
+
+        if (strncmp(m->search, sel->search, m->len) != 0)
+            continue;
+
+        tmp = sel->swap_index;
+        sel->swap_index = m->index;
+        m->index = tmp;
+        m->crate = NULL;
+
+        push_level(sel, m->len);
+        return;
+    }
+}
+
+/*
+ * Bring the view up to date with the search, starting from the
+ * last level
+ *
+ * A large search is done in the background, and the existing view
+ * remains until the result is collected. Do not disrupt the running
+ * process on memory allocation failure, leave the view index
+ * incomplete.
+ *
+ * Return: true if the view is up to date, or false if the search is
+ * in progress
+ */
+
+static bool do_search(struct selector *sel)
+{
+    struct index *src;
+
+    if (sel->level[sel->levels - 1].len == sel->search_len) {
+        selector_cancel(sel);
+        return true;
+    }
+
+    src = sel->view_index;
+
+    if (src->entries >= BACKGROUND_SEARCH) {
+        if (matcher_submit(&sel->matcher, src, &sel->match) == 0) {
+            sel->searching = true;
+            return false;
+        }
+    }
+
+    /* Any search in the background is now out of date */
+
+    selector_cancel(sel);
+
+    (void)index_match(src, &sel->swap_index, &sel->match);
+    push_level(sel, sel->search_len);
+
+    return true;
+}
+
 /*
  * When the crate has changed, update the current index to reflect
  * the crate and the search criteria
@@ -137,7 +363,12 @@ static void notify(struct selector *s)
 
 static void do_content_change(struct selector *sel)
 {
-    (void)index_match(initial(sel), sel->view_index, &sel->match);
+    sel->stale = false;
+
+    reset_levels(sel);
+    memo_fetch(sel);
+    (void)do_search(sel);
+
     listbox_set_entries(&sel->records, sel->view_index->entries);
     retain_target(sel);
     notify(sel);
@@ -171,28 +402,53 @@ static void handle_refresh(struct observer *o, void *x)
 
 /*
  * A new record has been added to the currently selected crate. Merge
- * this new addition into the current view, if applicable.
+ * this new addition into each level of the search, if applicable.
  */
 
 static void merge_addition(struct observer *o, void *x)
 {
     struct selector *s = container_of(o, struct selector, on_addition);
     struct record *r = x;
+    size_t n;
+    bool shown;
 
     assert(r != NULL);
 
-    if (!record_match(r, &s->match))
-        return;
+    /* The search in progress may not have seen this record; the
+     * view is merged now and the search repeated when it completes */
 
-    /* If we're out of memory then silently drop it */
+    if (s->searching)
+        s->stale = true;
 
-    if (index_reserve(s->view_index, 1) == -1)
+    if (s->bpm > 0.0 && !record_tempo(r, &s->tempo))
         return;
 
-    if (s->sort == SORT_PLAYLIST)
-        index_add(s->view_index, r);
-    else
-        index_insert(s->view_index, r, s->sort);
+    /* Each level is kept up to date, even though only the last
+     * is visible. If we're out of memory then silently drop it */
+
+    shown = false;
+
+    for (n = 0; n < s->levels; n++) {
+        struct level *l = &s->level[n];
+
+        shown = false;
+
+        if (!record_match(r, &l->match))
+            continue;
+
+        if (index_reserve(&l->index, 1) == -1)
+            continue;
+
+        if (s->sort == SORT_PLAYLIST)
+            index_add(&l->index, r);
+        else
+            index_insert(&l->index, r, s->sort);
+
+        shown = true;
+    }
+
+    if (!shown)
+        return;
 
     listbox_set_entries(&s->records, s->view_index->entries);
 
@@ -208,6 +464,19 @@ static void merge_addition(struct observer *o, void *x)
     notify(s);
 }
 
+/*
+ * Callback notification that a background search has completed
+ *
+ * This is called from a search thread, so only pass it on for the
+ * selector to be updated in the usual thread.
+ */
+
+static void handle_match(struct observer *o, void *x)
+{
+    struct selector *s = container_of(o, struct selector, on_match);
+    fire(&s->searched, NULL);
+}
+
 /*
  * Attach callbacks to the relevant crate
  *
@@ -224,6 +493,7 @@ static void watch_crate(struct selector *s, struct crate *c)
 
 void selector_init(struct selector *sel, struct library *lib)
 {
+    size_t n;
     struct crate *c;
 
     sel->library = lib;
@@ -239,29 +509,57 @@ void selector_init(struct selector *sel, struct library *lib)
     sel->search[0] = '\0';
     sel->search_len = 0;
     sel->target = NULL;
-
-    index_init(&sel->index_a);
-    index_init(&sel->index_b);
-    sel->view_index = &sel->index_a;
-    sel->swap_index = &sel->index_b;
+    sel->searching = false;
+    sel->stale = false;
+    sel->bpm = 0.0;
+    sel->tolerance = 0.0;
+
+    for (n = 0; n < SELECTOR_LEVELS; n++)
+        index_init(&sel->level[n].index);
+    index_init(&sel->swap_index);
+
+    for (n = 0; n < SELECTOR_MEMO; n++) {
+        sel->memo[n].crate = NULL;
+        index_init(&sel->memo[n].index);
+    }
+    sel->next_memo = 0;
 
     c = current_crate(sel);
     watch_crate(sel, c);
 
-    (void)index_copy(initial(sel), sel->view_index);
+    reset_levels(sel);
     listbox_set_entries(&sel->records, sel->view_index->entries);
 
     event_init(&sel->changed);
+    event_init(&sel->searched);
+
+    /* Without the threads, every search is done immediately */
+
+    if (matcher_init(&sel->matcher) == -1)
+        fputs("Library search will not be done in the background.\n", stderr);
+    watch(&sel->on_match, &sel->matcher.completion, handle_match);
 }
 
 void selector_clear(struct selector *sel)
 {
+    size_t n;
+
+    matcher_cancel(&sel->matcher);
+    ignore(&sel->on_match);
+    matcher_clear(&sel->matcher);
+
     event_clear(&sel->changed);
+    event_clear(&sel->searched);
     ignore(&sel->on_activity);
     ignore(&sel->on_refresh);
     ignore(&sel->on_addition);
-    index_clear(&sel->index_a);
-    index_clear(&sel->index_b);
+
+    for (n = 0; n < SELECTOR_LEVELS; n++)
+        index_clear(&sel->level[n].index);
+    index_clear(&sel->swap_index);
+
+    for (n = 0; n < SELECTOR_MEMO; n++)
+        index_clear(&sel->memo[n].index);
 }
 
 /*
@@ -371,6 +669,7 @@ static void do_crate_change(struct selector *sel)
 
 void selector_prev(struct selector *sel)
 {
+    memo_store(sel);
     listbox_up(&sel->crates, 1);
     sel->toggled = false;
     do_crate_change(sel);
@@ -378,6 +677,7 @@ void selector_prev(struct selector *sel)
 
 void selector_next(struct selector *sel)
 {
+    memo_store(sel);
     listbox_down(&sel->crates, 1);
     sel->toggled = false;
     do_crate_change(sel);
@@ -389,6 +689,8 @@ void selector_next(struct selector *sel)
 
 void selector_toggle(struct selector *sel)
 {
+    memo_store(sel);
+
     if (!sel->toggled) {
         sel->toggle_back = listbox_current(&sel->crates);
         listbox_first(&sel->crates);
@@ -408,10 +710,36 @@ void selector_toggle(struct selector *sel)
 void selector_toggle_order(struct selector *sel)
 {
     set_target(sel);
+    memo_store(sel);
+    sel->bpm = 0.0; /* tempo is only in BPM order */
     sel->sort = (sel->sort + 1) % SORT_END;
     do_content_change(sel);
 }
 
+/*
+ * Show only records of a tempo compatible with the given BPM, in BPM
+ * order
+ *
+ * The tolerance is a fraction of the BPM. A BPM of zero shows records
+ * of any tempo.
+ */
+
+void selector_set_tempo(struct selector *sel, double bpm, double tolerance)
+{
+    set_target(sel);
+    memo_store(sel);
+
+    sel->bpm = bpm;
+    sel->tolerance = tolerance;
+
+    if (bpm > 0.0) {
+        tempo_compile(&sel->tempo, bpm, tolerance);
+        sel->sort = SORT_BPM;
+    }
+
+    do_content_change(sel);
+}
+
 /*
  * Request a re-scan on the currently selected crate
  */
@@ -425,7 +753,8 @@ void selector_rescan(struct selector *sel)
 }
 
 /*
- * Expand the search. Do not disrupt the running process on memory
+ * Expand the search. The result for the shorter search is usually
+ * still to hand, but do not disrupt the running process on memory
  * allocation failure, leave the view index incomplete
  */
 
@@ -437,7 +766,12 @@ void selector_search_expand(struct selector *sel)
     sel->search[--sel->search_len] = '\0';
     match_compile(&sel->match, sel->search);
 
-    do_content_change(sel);
+    pop_levels(sel, sel->search_len);
+    (void)do_search(sel);
+
+    listbox_set_entries(&sel->records, sel->view_index->entries);
+    retain_target(sel);
+    notify(sel);
 }
 
 /*
@@ -447,8 +781,6 @@ void selector_search_expand(struct selector *sel)
 
 void selector_search_refine(struct selector *sel, char key)
 {
-    struct index *tmp;
-
     if (sel->search_len >= sizeof(sel->search) - 1) /* would overflow */
         return;
 
@@ -456,13 +788,61 @@ void selector_search_refine(struct selector *sel, char key)
     sel->search[++sel->search_len] = '\0';
     match_compile(&sel->match, sel->search);
 
-    (void)index_match(sel->view_index, sel->swap_index, &sel->match);
+    /* The current view is a superset of the refined search, even if
+     * a search is still in progress to narrow it */
 
-    tmp = sel->view_index;
-    sel->view_index = sel->swap_index;
-    sel->swap_index = tmp;
+    if (do_search(sel)) {
+        listbox_set_entries(&sel->records, sel->view_index->entries);
+        set_target(sel);
+    }
+
+    notify(sel);
+}
+
+/*
+ * Take the result of a search which was done in the background
+ *
+ * Called in response to the 'searched' event, from the thread which
+ * uses the selector.
+ */
+
+void selector_collect(struct selector *sel)
+{
+    if (!sel->searching)
+        return;
+
+    if (!matcher_collect(&sel->matcher, &sel->swap_index))
+        return; /* superseded by a more recent search */
+
+    sel->searching = false;
+
+    if (sel->stale) {
+        /* Additions were merged into each level, but this result may
+         * be missing some of them */
+
+        sel->stale = false;
+        if (!do_search(sel))
+            return;
+    } else {
+        push_level(sel, sel->search_len);
+    }
 
     listbox_set_entries(&sel->records, sel->view_index->entries);
-    set_target(sel);
+    retain_target(sel);
     notify(sel);
 }
+
+/*
+ * Cancel any search in the background
+ *
+ * Post: no 'searched' events are fired until the next search
+ */
+
+void selector_cancel(struct selector *sel)
+{
+    if (!sel->searching)
+        return;
+
+    matcher_cancel(&sel->matcher);
+    sel->searching = false;
+}
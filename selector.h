@@ -26,25 +26,72 @@
 #include "library.h"
 #include "listbox.h"
 #include "index.h"
+#include "matcher.h"
+
+#define SELECTOR_LEVELS 8
+#define SELECTOR_MEMO 4
+
+/* The result of searching for a prefix of the search string */
+
+struct level {
+    size_t len; /* of the prefix */
+    struct match match;
+    struct index index;
+};
+
+/* A result kept aside when leaving a crate, valid only whilst the
+ * crate content is unchanged */
+
+struct memo {
+    struct crate *crate; /* or NULL if unused */
+    unsigned int generation;
+    int sort;
+    double bpm, tolerance;
+    size_t len;
+    char search[256];
+    struct index index;
+};
 
 struct selector {
     struct library *library;
+
+    /* Results for successively longer prefixes of the search, the
+     * first being the entire crate */
+
+    struct level level[SELECTOR_LEVELS];
+    size_t levels;
+
     struct index
-        *view_index, /* base_index + search filter applied */
-        *swap_index, /* used to swap between a and b indexes */
-        index_a, index_b;
+        *view_index, /* the last level */
+        swap_index; /* the next level, whilst it is being made */
+
+    struct memo memo[SELECTOR_MEMO];
+    size_t next_memo;
 
     struct listbox records, crates;
     bool toggled;
     int toggle_back, sort;
     struct record *target;
-    struct observer on_activity, on_refresh, on_addition;
+    struct observer on_activity, on_refresh, on_addition, on_match;
 
     size_t search_len;
     char search[256];
     struct match match; /* the compiled search, kept in-sync */
 
-    struct event changed;
+    /* Optionally, only records of a compatible tempo */
+
+    double bpm, /* or 0.0 for any tempo */
+        tolerance;
+    struct tempo tempo; /* compiled, if bpm is set */
+
+    /* Large searches are done in the background */
+
+    struct matcher matcher;
+    bool searching, /* view_index is not yet the result of the search */
+        stale; /* crate content changed during the search */
+
+    struct event changed,
+        searched; /* fired from another thread; see selector_collect() */
 };
 
 void selector_init(struct selector *sel, struct library *lib);
@@ -70,4 +117,9 @@ void selector_rescan(struct selector *sel);
 void selector_search_expand(struct selector *sel);
 void selector_search_refine(struct selector *sel, char key);
 
+void selector_set_tempo(struct selector *sel, double bpm, double tolerance);
+
+void selector_collect(struct selector *sel);
+void selector_cancel(struct selector *sel);
+
 #endif
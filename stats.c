@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <assert.h>
+
+#include "stats.h"
+
+/*
+ * Return: upper bound of the given bucket
+ */
+
+static double bound(const struct stats *s, unsigned int n)
+{
+    return s->base * (double)(1UL << n);
+}
+
+/*
+ * Add a measurement to the histogram
+ */
+
+void stats_add(struct stats *s, double x)
+{
+    unsigned int n;
+
+    if (s->count == 0 || x < s->min)
+        s->min = x;
+    if (s->count == 0 || x > s->max)
+        s->max = x;
+
+    s->count++;
+    s->sum += x;
+
+    /* The last bucket has no upper bound */
+
+    for (n = 0; n < STATS_BUCKETS - 1; n++) {
+        if (x <= bound(s, n))
+            break;
+    }
+
+    s->bucket[n]++;
+}
+
+/*
+ * Estimate a percentile of the measurements
+ *
+ * The estimate is the upper bound of the bucket it falls in, which
+ * is within a factor of two, and never more than the maximum.
+ *
+ * Return: estimate, or 0.0 if there are no measurements
+ */
+
+double stats_percentile(const struct stats *s, double p)
+{
+    unsigned int n;
+    unsigned long target, total;
+
+    assert(p >= 0.0 && p <= 100.0);
+
+    if (s->count == 0)
+        return 0.0;
+
+    target = (unsigned long)(s->count * p / 100.0 + 0.5);
+    if (target < 1)
+        target = 1;
+
+    total = 0;
+
+    for (n = 0; n < STATS_BUCKETS - 1; n++) {
+        total += s->bucket[n];
+        if (total >= target)
+            break;
+    }
+
+    if (n == STATS_BUCKETS - 1 || bound(s, n) > s->max)
+        return s->max;
+
+    return bound(s, n);
+}
+
+/*
+ * Write out a summary of the measurements, followed by the count in
+ * each bucket which is not empty
+ */
+
+void stats_dump(FILE *f, const struct stats *s)
+{
+    unsigned int n;
+
+    fprintf(f, "%s (%s): count %lu", s->name, s->unit, s->count);
+
+    if (s->count > 0) {
+        fprintf(f, ", min %g, mean %g, median %g, 90%% %g, max %g",
+                s->min, s->sum / s->count, stats_percentile(s, 50.0),
+                stats_percentile(s, 90.0), s->max);
+    }
+
+    fputc('\n', f);
+
+    for (n = 0; n < STATS_BUCKETS; n++) {
+        if (s->bucket[n] == 0)
+            continue;
+
+        if (n == STATS_BUCKETS - 1)
+            fprintf(f, "  > %g\t%lu\n", bound(s, n - 1), s->bucket[n]);
+        else
+            fprintf(f, "  <= %g\t%lu\n", bound(s, n), s->bucket[n]);
+    }
+}
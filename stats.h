@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+/*
+ * A histogram of measurements, in buckets which double in size
+ */
+
+#define STATS_BUCKETS 24
+
+struct stats {
+    const char *name, *unit;
+    double base; /* upper bound of the first bucket */
+
+    unsigned long count;
+    double sum, min, max;
+    unsigned long bucket[STATS_BUCKETS];
+};
+
+#define STATS_INIT(n, u, b) { .name = (n), .unit = (u), .base = (b) }
+
+void stats_add(struct stats *s, double x);
+double stats_percentile(const struct stats *s, double p);
+void stats_dump(FILE *f, const struct stats *s);
+
+#endif
@@ -0,0 +1,648 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Values for every track, such as its cue points, kept in a single
+ * file
+ *
+ * Each line of the file is the pathname of a track followed by each
+ * of its values, all separated by tabs; a value which is not set is
+ * "-", and those at the end are left out. For cue points, the values
+ * are the position of each in seconds; as with the cueloader, the
+ * labelled cue points come first and any others follow. A later line
+ * for a track replaces any earlier one, so the file need only ever be
+ * appended to. When it has grown to be mostly out of date, it is
+ * written again in full as it is opened.
+ *
+ * The whole file is read into a hash table, so that the values are
+ * known as soon as a track is loaded. New lines are written by a
+ * thread of their own, so that a slow disk does not hold up the
+ * interface.
+ */
+
+#define _GNU_SOURCE /* asprintf(), getline() */
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "store.h"
+#include "mutex.h"
+
+#define MIN_SLOTS 256
+#define COMPACT_LINES 1024 /* lines out of date before a rewrite */
+
+struct store_entry {
+    char *path; /* or NULL if the slot is empty */
+    size_t nvalues;
+    double *value;
+};
+
+/*
+ * Return: hash of a pathname
+ */
+
+static uint64_t hash(const char *s)
+{
+    uint64_t h;
+
+    h = 14695981039346656037ULL; /* FNV-1a */
+
+    while (*s != '\0') {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+/*
+ * Return: slot for the given pathname, which is empty if it has no
+ * entry
+ * Pre: table has at least one empty slot
+ */
+
+static struct store_entry* find(struct store *s, const char *path)
+{
+    size_t n;
+
+    n = hash(path) & (s->slots - 1);
+
+    for (;;) {
+        struct store_entry *e = &s->table[n];
+
+        if (e->path == NULL || strcmp(e->path, path) == 0)
+            return e;
+
+        n = (n + 1) & (s->slots - 1);
+    }
+}
+
+/*
+ * Double the size of the table
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ */
+
+static int grow(struct store *s)
+{
+    size_t n, old_slots;
+    struct store_entry *old;
+
+    old = s->table;
+    old_slots = s->slots;
+
+    s->slots = s->slots == 0 ? MIN_SLOTS : s->slots * 2;
+    s->table = calloc(s->slots, sizeof *s->table);
+    if (s->table == NULL) {
+        perror("calloc");
+        s->table = old;
+        s->slots = old_slots;
+        return -1;
+    }
+
+    for (n = 0; n < old_slots; n++) {
+        if (old[n].path != NULL)
+            *find(s, old[n].path) = old[n];
+    }
+
+    free(old);
+    return 0;
+}
+
+/*
+ * Set the values of a track, leaving out those not set at the end
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ * Pre: lock is held
+ */
+
+static int set(struct store *s, const char *path,
+               const double *value, size_t n)
+{
+    double *v;
+    struct store_entry *e;
+
+    while (n > 0 && value[n - 1] == HUGE_VAL)
+        n--;
+
+    if ((s->entries + 1) * 2 > s->slots && grow(s) == -1)
+        return -1;
+
+    v = malloc(sizeof *v * (n > 0 ? n : 1));
+    if (v == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    memcpy(v, value, sizeof *v * n);
+
+    e = find(s, path);
+
+    if (e->path == NULL) {
+        e->path = strdup(path);
+        if (e->path == NULL) {
+            perror("strdup");
+            free(v);
+            return -1;
+        }
+        s->entries++;
+    } else {
+        free(e->value);
+    }
+
+    e->value = v;
+    e->nvalues = n;
+
+    return 0;
+}
+
+/*
+ * Parse a line of the file and set the values it gives
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ * Pre: lock is held
+ */
+
+static int parse(struct store *s, char *line)
+{
+    size_t n, size;
+    double *value;
+    char *path, *f;
+    int r;
+
+    path = strsep(&line, "\t");
+    if (path[0] == '\0')
+        return 0;
+
+    n = 0;
+    size = 16;
+    value = malloc(sizeof *value * size);
+    if (value == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    while ((f = strsep(&line, "\t")) != NULL) {
+        char *end;
+        double v;
+
+        if (n == size) {
+            double *q;
+
+            size *= 2;
+            q = realloc(value, sizeof *value * size);
+            if (q == NULL) {
+                perror("realloc");
+                free(value);
+                return -1;
+            }
+            value = q;
+        }
+
+        v = strtod(f, &end);
+        if (f[0] == '-' || end == f || *end != '\0' || !isfinite(v) || v < 0.0)
+            v = HUGE_VAL;
+
+        value[n++] = v;
+    }
+
+    r = set(s, path, value, n);
+    free(value);
+
+    return r;
+}
+
+/*
+ * Append a line for a track to the given buffer
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ */
+
+static int format(char **buf, size_t *len, size_t *size,
+                  const char *path, const double *value, size_t n)
+{
+    size_t i, need;
+
+    need = strlen(path) + n * 32 + 2;
+
+    if (*len + need > *size) {
+        char *b;
+        size_t s;
+
+        s = (*len + need) * 2;
+        b = realloc(*buf, s);
+        if (b == NULL) {
+            perror("realloc");
+            return -1;
+        }
+
+        *buf = b;
+        *size = s;
+    }
+
+    *len += sprintf(*buf + *len, "%s", path);
+
+    for (i = 0; i < n; i++) {
+        if (value[i] == HUGE_VAL)
+            *len += sprintf(*buf + *len, "\t-");
+        else
+            *len += sprintf(*buf + *len, "\t%0.6f", value[i]);
+    }
+
+    *len += sprintf(*buf + *len, "\n");
+
+    return 0;
+}
+
+/*
+ * Read every line of the file into the table
+ *
+ * Return: number of lines, or -1 on error
+ * Pre: lock is held
+ */
+
+static ssize_t load(struct store *s, const char *pathname)
+{
+    FILE *f;
+    char *line;
+    size_t size;
+    ssize_t z, lines;
+
+    f = fopen(pathname, "r");
+    if (f == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        perror("fopen");
+        return -1;
+    }
+
+    line = NULL;
+    size = 0;
+    lines = 0;
+
+    while ((z = getline(&line, &size, f)) != -1) {
+        if (z > 0 && line[z - 1] == '\n')
+            line[z - 1] = '\0';
+
+        if (parse(s, line) == -1) {
+            lines = -1;
+            break;
+        }
+
+        lines++;
+    }
+
+    free(line);
+    fclose(f);
+
+    return lines;
+}
+
+/*
+ * Write the whole table to the file, replacing it
+ *
+ * Return: 0 on success, or -1 on error
+ * Pre: lock is held
+ */
+
+static int compact(struct store *s, const char *pathname)
+{
+    size_t n, len, size;
+    char *buf, *tmp;
+    FILE *f;
+    int r;
+
+    buf = NULL;
+    len = 0;
+    size = 0;
+
+    for (n = 0; n < s->slots; n++) {
+        const struct store_entry *e = &s->table[n];
+
+        if (e->path == NULL || e->nvalues == 0)
+            continue;
+
+        if (format(&buf, &len, &size, e->path, e->value, e->nvalues) == -1) {
+            free(buf);
+            return -1;
+        }
+    }
+
+    if (asprintf(&tmp, "%s.new", pathname) == -1) {
+        perror("asprintf");
+        free(buf);
+        return -1;
+    }
+
+    r = -1;
+
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        perror("fopen");
+        goto out;
+    }
+
+    if (fwrite(buf, 1, len, f) != len) {
+        perror("fwrite");
+        fclose(f);
+        goto out;
+    }
+
+    if (fclose(f) != 0) {
+        perror("fclose");
+        goto out;
+    }
+
+    if (rename(tmp, pathname) == -1) {
+        perror("rename");
+        goto out;
+    }
+
+    r = 0;
+out:
+    free(tmp);
+    free(buf);
+    return r;
+}
+
+static void* write_out(void *p)
+{
+    struct store *s = p;
+
+    mutex_lock(&s->lock);
+
+    for (;;) {
+        char *buf;
+        size_t len;
+
+        while (!s->quit && s->pending_len == 0)
+            pthread_cond_wait(&s->work, &s->lock);
+
+        if (s->pending_len == 0)
+            break;
+
+        /* Take everything which is waiting, in a single write */
+
+        buf = s->pending;
+        len = s->pending_len;
+        s->pending = NULL;
+        s->pending_len = 0;
+        s->pending_size = 0;
+
+        mutex_unlock(&s->lock);
+
+        if (fwrite(buf, 1, len, s->file) != len || fflush(s->file) != 0)
+            perror(s->name);
+
+        free(buf);
+        mutex_lock(&s->lock);
+    }
+
+    mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+/*
+ * Create the directory of the given pathname, and those it is in
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int make_dirs(const char *pathname)
+{
+    char *s, *p;
+
+    s = strdup(pathname);
+    if (s == NULL) {
+        perror("strdup");
+        return -1;
+    }
+
+    for (p = strchr(s + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+
+        if (mkdir(s, 0755) == -1 && errno != EEXIST) {
+            perror("mkdir");
+            free(s);
+            return -1;
+        }
+
+        *p = '/';
+    }
+
+    free(s);
+    return 0;
+}
+
+/*
+ * Return: pathname of the named file in the usual place for user
+ * data, or NULL if there is none
+ */
+
+static char* default_pathname(const char *name)
+{
+    const char *dir;
+    char *s;
+    int r;
+
+    dir = getenv("XDG_DATA_HOME");
+    if (dir != NULL && dir[0] != '\0') {
+        r = asprintf(&s, "%s/xwax/%s", dir, name);
+    } else {
+        dir = getenv("HOME");
+        if (dir == NULL)
+            return NULL;
+        r = asprintf(&s, "%s/.local/share/xwax/%s", dir, name);
+    }
+
+    if (r == -1) {
+        perror("asprintf");
+        return NULL;
+    }
+
+    return s;
+}
+
+/*
+ * Open the file of the store, and read it in
+ *
+ * If the pathname is NULL, the file is in the usual place for user
+ * data, by the name of the store. Values can be used regardless of
+ * the return value, but are only saved if the file was opened.
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+int store_open(struct store *s, const char *pathname)
+{
+    char *d;
+    ssize_t lines;
+    int r;
+
+    assert(s->file == NULL);
+
+    d = NULL;
+    if (pathname == NULL) {
+        d = default_pathname(s->name);
+        if (d == NULL)
+            return -1;
+        pathname = d;
+    }
+
+    r = -1;
+    mutex_lock(&s->lock);
+
+    if (make_dirs(pathname) == -1)
+        goto out;
+
+    lines = load(s, pathname);
+    if (lines == -1)
+        goto out;
+
+    if ((size_t)lines >= s->entries + COMPACT_LINES
+        && (size_t)lines > s->entries * 2)
+    {
+        (void)compact(s, pathname);
+    }
+
+    s->file = fopen(pathname, "a");
+    if (s->file == NULL) {
+        perror("fopen");
+        goto out;
+    }
+
+    s->quit = false;
+
+    if (pthread_create(&s->writer, NULL, write_out, s) != 0) {
+        perror("pthread_create");
+        fclose(s->file);
+        s->file = NULL;
+        goto out;
+    }
+
+    r = 0;
+out:
+    mutex_unlock(&s->lock);
+    free(d);
+    return r;
+}
+
+/*
+ * Write out any values waiting to be saved, close the file, and
+ * forget every value
+ */
+
+void store_close(struct store *s)
+{
+    size_t n;
+
+    if (s->file != NULL) {
+        mutex_lock(&s->lock);
+        s->quit = true;
+        pthread_cond_signal(&s->work);
+        mutex_unlock(&s->lock);
+
+        if (pthread_join(s->writer, NULL) != 0)
+            abort();
+
+        if (fclose(s->file) != 0)
+            perror("fclose");
+        s->file = NULL;
+    }
+
+    for (n = 0; n < s->slots; n++) {
+        free(s->table[n].path);
+        free(s->table[n].value);
+    }
+
+    free(s->table);
+    s->table = NULL;
+    s->slots = 0;
+    s->entries = 0;
+}
+
+/*
+ * Get the values of a track
+ *
+ * Return: number of values kept for the track, of which the first n
+ * are copied to 'value'
+ */
+
+size_t store_get(struct store *s, const char *path,
+                 double *value, size_t n)
+{
+    size_t nvalues;
+    const struct store_entry *e;
+
+    mutex_lock(&s->lock);
+
+    if (s->slots == 0) {
+        mutex_unlock(&s->lock);
+        return 0;
+    }
+
+    e = find(s, path);
+
+    nvalues = e->path == NULL ? 0 : e->nvalues;
+    if (n > nvalues)
+        n = nvalues;
+    if (n > 0)
+        memcpy(value, e->value, sizeof *value * n);
+
+    mutex_unlock(&s->lock);
+
+    return nvalues;
+}
+
+/*
+ * Keep the values of a track, and save them in the background
+ *
+ * A value which is not set is HUGE_VAL.
+ */
+
+void store_put(struct store *s, const char *path,
+               const double *value, size_t n)
+{
+    if (strpbrk(path, "\t\n") != NULL) {
+        fprintf(stderr, "Cannot keep %s of '%s'\n", s->name, path);
+        return;
+    }
+
+    mutex_lock(&s->lock);
+
+    if (set(s, path, value, n) == 0 && s->file != NULL) {
+        const struct store_entry *e = find(s, path);
+
+        if (format(&s->pending, &s->pending_len, &s->pending_size, e->path,
+                   e->value, e->nvalues) == 0)
+        {
+            pthread_cond_signal(&s->work);
+        }
+    }
+
+    mutex_unlock(&s->lock);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef STORE_H
+#define STORE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "mutex.h"
+
+/* A file of values for every track, eg. cue points */
+
+struct store {
+    const char *name; /* of the file, in the usual place */
+
+    mutex lock;
+    struct store_entry *table;
+    size_t slots, entries;
+
+    /* New lines, which the writer thread appends to the file */
+
+    FILE *file; /* or NULL if values are not being saved */
+    pthread_t writer;
+    pthread_cond_t work;
+    bool quit;
+    char *pending;
+    size_t pending_len, pending_size;
+};
+
+#define STORE_INIT(n) { \
+    .name = (n), \
+    .lock = PTHREAD_MUTEX_INITIALIZER, \
+    .work = PTHREAD_COND_INITIALIZER \
+}
+
+int store_open(struct store *s, const char *pathname);
+void store_close(struct store *s);
+
+size_t store_get(struct store *s, const char *path,
+                 double *value, size_t n);
+void store_put(struct store *s, const char *path,
+               const double *value, size_t n);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bands.h"
+
+#define RATE 44100
+#define SECONDS 60
+#define SHIFT 8
+
+static const double tones[] = { 60.0, 1000.0, 8000.0 };
+
+static double now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+        perror("clock_gettime");
+        abort();
+    }
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Fill a buffer with stereo audio of the given frequency
+ */
+
+static void tone(signed short *pcm, size_t samples, double f)
+{
+    size_t n;
+
+    for (n = 0; n < samples; n++) {
+        signed short v;
+
+        v = 16384 * sin(2.0 * M_PI * f * n / RATE);
+        pcm[n * 2] = v;
+        pcm[n * 2 + 1] = v;
+    }
+}
+
+/*
+ * Manual test of the frequency band meters, and a benchmark of their
+ * cost to the import of a track
+ */
+
+int main(int argc, char *argv[])
+{
+    size_t n, samples;
+    signed short *pcm;
+    unsigned char (*out)[BANDS];
+    struct bands b;
+    double start, elapsed;
+
+    samples = RATE * SECONDS;
+
+    pcm = malloc(sizeof(signed short) * 2 * samples);
+    out = malloc(sizeof(*out) * ((samples >> SHIFT) + 1));
+    if (pcm == NULL || out == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    /* Each tone should appear mostly in its own band */
+
+    for (n = 0; n < sizeof(tones) / sizeof(*tones); n++) {
+        unsigned char *last;
+
+        tone(pcm, RATE, tones[n]);
+        bands_init(&b, RATE);
+        bands_process(&b, pcm, 0, RATE, out, SHIFT);
+
+        last = out[(RATE - 1) >> SHIFT];
+        printf("%6.0fHz: low %3d, mid %3d, high %3d\n", tones[n],
+               last[BAND_LOW], last[BAND_MID], last[BAND_HIGH]);
+
+        if (last[n] <= last[(n + 1) % BANDS]
+            || last[n] <= last[(n + 2) % BANDS])
+        {
+            fprintf(stderr, "Tone is not in the expected band\n");
+            return -1;
+        }
+    }
+
+    /* Time a long stretch of audio, in the chunks of a pipe */
+
+    for (n = 0; n < samples * 2; n++)
+        pcm[n] = rand() % 65536 - 32768;
+
+    bands_init(&b, RATE);
+
+    start = now();
+    for (n = 0; n < samples; n += 16384) {
+        size_t len;
+
+        len = samples - n < 16384 ? samples - n : 16384;
+        bands_process(&b, pcm + n * 2, n, len, out, SHIFT);
+    }
+    elapsed = now() - start;
+
+    printf("%d seconds of audio in %0.3f seconds; %0.1f ns per sample, "
+           "%0.0f times realtime\n", SECONDS, elapsed,
+           elapsed / samples * 1e9, SECONDS / elapsed);
+
+    free(pcm);
+    free(out);
+
+    return 0;
+}
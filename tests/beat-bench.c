@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Benchmark of the analysis of tempo
+ *
+ * The audio is synthetic: a kick drum on every beat and a hi-hat
+ * between, over a quiet chord and noise. The tempo found is given
+ * alongside the true one, so that a change in speed can be weighed
+ * against any change in accuracy.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "beat.h"
+#include "thread.h"
+#include "track.h"
+
+#define DEFAULT_RUNS 3
+#define RATE 44100
+#define OFFSET 0.25 /* seconds to the first beat */
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+static const double tempos[] = { 87.0, 90.0, 124.0, 128.5, 140.0, 174.0 };
+
+static bool json;
+static bool first_result = true;
+static unsigned int runs = DEFAULT_RUNS;
+static uint64_t seed = 88172645463325252ULL;
+
+/*
+ * Return: random number in the range [-1.0, 1.0)
+ */
+
+static double noise(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (seed >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+static double cpu(const struct rusage *ru)
+{
+    return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6
+        + ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * Return: one sample of the synthetic audio
+ */
+
+static double synth(double t, double bpm)
+{
+    double period, b, x;
+
+    period = 60.0 / bpm;
+    x = 0.02 * noise()
+        + 0.05 * (sin(2 * M_PI * 220.0 * t) + sin(2 * M_PI * 277.2 * t));
+
+    if (t < OFFSET)
+        return x;
+
+    b = fmod(t - OFFSET, period); /* since the beat */
+
+    if (b < 0.15) {
+        double f;
+
+        f = 45.0 + 60.0 * exp(-b * 30.0); /* falling pitch */
+        x += 0.6 * exp(-b * 25.0) * sin(2 * M_PI * f * b);
+    }
+
+    b = fmod(t - OFFSET + period / 2, period);
+    if (b < 0.04)
+        x += 0.2 * exp(-b * 100.0) * noise();
+
+    return x;
+}
+
+/*
+ * Fill a track with the synthetic audio
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ */
+
+static int make_track(struct track *t, unsigned int seconds, double bpm)
+{
+    unsigned int s;
+
+    memset(t, 0, sizeof *t);
+    t->rate = RATE;
+    t->length = seconds * RATE;
+
+    for (s = 0; s < t->length; s++) {
+        struct track_block *b;
+        signed short v;
+
+        if (s % TRACK_BLOCK_SAMPLES == 0) {
+            assert(t->blocks < TRACK_MAX_BLOCKS);
+            b = malloc(sizeof *b);
+            if (b == NULL) {
+                perror("malloc");
+                return -1;
+            }
+            t->block[t->blocks++] = b;
+        }
+
+        b = t->block[s / TRACK_BLOCK_SAMPLES];
+        v = synth((double)s / RATE, bpm) * 32767.0;
+        b->pcm[(s % TRACK_BLOCK_SAMPLES) * TRACK_CHANNELS] = v;
+        b->pcm[(s % TRACK_BLOCK_SAMPLES) * TRACK_CHANNELS + 1] = v;
+    }
+
+    return 0;
+}
+
+static void free_track(struct track *t)
+{
+    unsigned int n;
+
+    for (n = 0; n < t->blocks; n++)
+        free(t->block[n]);
+}
+
+/*
+ * Print the result of a single measurement
+ */
+
+static void report(unsigned int seconds, unsigned int run, double bpm,
+                   const struct beat *b, double cpu)
+{
+    double rate;
+
+    rate = seconds / 60.0 / cpu;
+
+    if (json) {
+        printf("%s\n  {\"seconds\": %u, \"run\": %u, \"bpm\": %.2f, "
+               "\"offset\": %.3f, \"found_bpm\": %.2f, "
+               "\"found_offset\": %.3f, \"cpu\": %.6f, "
+               "\"minutes_per_cpu_s\": %.1f}",
+               first_result ? "[" : ",",
+               seconds, run, bpm, OFFSET, b->bpm, b->offset, cpu, rate);
+    } else {
+        if (first_result) {
+            printf("seconds,run,bpm,offset,found_bpm,found_offset,"
+                   "cpu,minutes_per_cpu_s\n");
+        }
+        printf("%u,%u,%.2f,%.3f,%.2f,%.3f,%.6f,%.1f\n",
+               seconds, run, bpm, OFFSET, b->bpm, b->offset, cpu, rate);
+    }
+
+    first_result = false;
+}
+
+/*
+ * Analyse tracks of the given length at each tempo
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int bench(unsigned int seconds)
+{
+    size_t n;
+    unsigned int run;
+
+    for (n = 0; n < ARRAY_SIZE(tempos); n++) {
+        struct track t;
+
+        if (make_track(&t, seconds, tempos[n]) == -1)
+            return -1;
+
+        for (run = 0; run < runs; run++) {
+            struct rusage before, after;
+            struct beat b;
+
+            if (getrusage(RUSAGE_SELF, &before) == -1) {
+                perror("getrusage");
+                return -1;
+            }
+
+            if (beat_analyse(&t, &b) == -1) {
+                b.bpm = 0.0;
+                b.offset = 0.0;
+            }
+
+            if (getrusage(RUSAGE_SELF, &after) == -1) {
+                perror("getrusage");
+                return -1;
+            }
+
+            report(seconds, run, tempos[n], &b, cpu(&after) - cpu(&before));
+        }
+
+        free_track(&t);
+    }
+
+    return 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-j] [-n <runs>] [<seconds> ...]\n\n"
+            "  -j  Output JSON, instead of CSV\n"
+            "  -n  Number of analyses of each track (default %d)\n",
+            argv0, DEFAULT_RUNS);
+}
+
+/*
+ * Manual benchmark of the analysis of tempo; by default, of tracks
+ * of 1, 5 and 10 minutes
+ */
+
+int main(int argc, char *argv[])
+{
+    int c;
+    size_t n;
+    static const unsigned int defaults[] = { 60, 300, 600 };
+
+    while ((c = getopt(argc, argv, "jn:")) != -1) {
+        switch (c) {
+        case 'j':
+            json = true;
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (thread_global_init() == -1)
+        return -1;
+
+    if (optind == argc) {
+        for (n = 0; n < ARRAY_SIZE(defaults); n++) {
+            if (bench(defaults[n]) == -1)
+                return -1;
+        }
+    } else {
+        for (n = optind; n < argc; n++) {
+            int seconds;
+
+            seconds = atoi(argv[n]);
+            if (seconds <= 0) {
+                usage(argv[0]);
+                return -1;
+            }
+
+            if (bench(seconds) == -1)
+                return -1;
+        }
+    }
+
+    if (json)
+        printf("%s\n", first_result ? "[]" : "\n]");
+
+    thread_global_clear();
+
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include <stdio.h>
 
 #include "cues.h"
+#include "thread.h"
 
 /*
  * Self-contained test of cue points
@@ -10,6 +11,11 @@
 int main(int argc, char *argv[])
 {
     struct cues q;
+    unsigned int n;
+    int r;
+
+    if (thread_global_init() == -1)
+        return -1;
 
     cues_reset(&q);
 
@@ -18,5 +24,34 @@ int main(int argc, char *argv[])
     cues_set(&q, 0, 100.0);
     assert(cues_get(&q, 0) == 100.0);
 
+    /* Many more cue points than are labelled, added out of order */
+
+    for (n = 0; n < 1000; n++) {
+        r = cues_add(&q, (n * 7 % 1000) * 10.0 + 5.0);
+        assert(r == 0);
+    }
+
+    r = cues_add(&q, 15.0); /* already there */
+    assert(r == 0);
+    assert(q.markers == 1000);
+
+    assert(cues_prev(&q, 5.0) == CUE_UNSET);
+    assert(cues_next(&q, 5.0) == 15.0);
+    assert(cues_prev(&q, 101.0) == 100.0);
+    assert(cues_next(&q, 100.0) == 105.0);
+    assert(cues_next(&q, 99.0) == 100.0);
+    assert(cues_next(&q, 9995.0) == CUE_UNSET);
+
+    assert(cues_count(&q, 0.0, 10000.0) == 1001);
+    assert(cues_count(&q, 95.0, 106.0) == 3);
+    assert(cues_count(&q, 106.0, 95.0) == 0);
+
+    cues_unset_all(&q);
+    assert(cues_next(&q, 0.0) == CUE_UNSET);
+    assert(cues_count(&q, 0.0, 10000.0) == 0);
+
+    cues_clear(&q);
+    thread_global_clear();
+
     return 0;
 }
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <signal.h>
+#include <stdio.h>
+
+#include "dirwatch.h"
+#include "rig.h"
+#include "thread.h"
+
+void handle(int signum)
+{
+    rig_quit();
+}
+
+static void print(const char *title, const struct paths *p)
+{
+    size_t n;
+
+    for (n = 0; n < p->entries; n++)
+        printf("%s: %s\n", title, p->path[n]);
+}
+
+static void change(struct observer *o, void *x)
+{
+    struct dirwatch *w = x;
+
+    print("file", &w->files);
+    print("directory", &w->subdirs);
+    print("removed", &w->removed);
+    fflush(stdout);
+}
+
+static void overflow(struct observer *o, void *x)
+{
+    printf("overflow\n");
+    fflush(stdout);
+}
+
+/*
+ * Manual test of watching a directory; print the changes as they
+ * are made
+ */
+
+int main(int argc, char *argv[])
+{
+    struct dirwatch w;
+    struct observer on_change, on_overflow;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <path>\n", argv[0]);
+        return -1;
+    }
+
+    if (thread_global_init() == -1)
+        return -1;
+
+    if (rig_init() == -1)
+        return -1;
+
+    if (signal(SIGINT, handle) == SIG_ERR) {
+        perror("signal");
+        return -1;
+    }
+
+    if (dirwatch_init(&w, argv[1]) == -1)
+        return -1;
+
+    watch(&on_change, &w.change, change);
+    watch(&on_overflow, &w.overflow, overflow);
+
+    rig_main();
+
+    ignore(&on_change);
+    ignore(&on_overflow);
+    dirwatch_clear(&w);
+
+    rig_clear();
+    thread_global_clear();
+
+    return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Benchmark of the transfer of audio from an importer into a track
+ *
+ * This program is also its own importer, and writes audio as fast as
+ * it can, so that what is measured is the cost to xwax of taking in
+ * the audio and not of decoding it. The context switches of this
+ * process are a measure of how often the rig is woken.
+ */
+
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "rig.h"
+#include "thread.h"
+#include "track.h"
+
+#define DEFAULT_RUNS 5
+#define RATE 44100
+#define CHUNK 16384 /* bytes per write by the importer */
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+static bool json;
+static bool first_result = true;
+static unsigned int runs = DEFAULT_RUNS;
+static const char *audio; /* or NULL for a pattern */
+
+/*
+ * Act as an importer: write the given number of seconds of audio to
+ * standard output
+ *
+ * The 'path' is the number of seconds, optionally followed by a
+ * colon and a file of raw audio to be repeated; otherwise a pattern
+ * is written.
+ */
+
+static int import(const char *path, const char *rate)
+{
+    size_t n, bytes;
+    char buf[CHUNK], *end;
+    FILE *f;
+
+    bytes = (size_t)strtol(path, &end, 10) * atoi(rate)
+        * sizeof(signed short) * TRACK_CHANNELS;
+
+    if (*end == ':') {
+        f = fopen(end + 1, "rb");
+        if (f == NULL) {
+            perror("fopen");
+            return -1;
+        }
+    } else {
+        f = NULL;
+        for (n = 0; n < sizeof buf; n++)
+            buf[n] = n * 7;
+    }
+
+    while (bytes > 0) {
+        size_t len;
+
+        len = bytes < sizeof buf ? bytes : sizeof buf;
+
+        if (f != NULL) {
+            len = fread(buf, 1, len, f);
+            if (len == 0) { /* end of file, or an empty one */
+                if (ferror(f) || ftell(f) == 0
+                    || fseek(f, 0, SEEK_SET) == -1)
+                {
+                    fputs("Audio could not be read\n", stderr);
+                    return -1;
+                }
+                continue;
+            }
+        }
+
+        if (fwrite(buf, 1, len, stdout) != len)
+            return -1;
+
+        bytes -= len;
+    }
+
+    if (f != NULL)
+        fclose(f);
+
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+        perror("clock_gettime");
+        abort();
+    }
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu(const struct rusage *ru)
+{
+    return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6
+        + ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+static void* run_rig(void *p)
+{
+    if (rig_main() == -1)
+        abort();
+
+    return NULL;
+}
+
+/*
+ * Print the result of a single measurement
+ */
+
+static void report(const char *seconds, unsigned int run, size_t bytes,
+                   double elapsed, double cpu, long switches)
+{
+    double rate;
+
+    rate = bytes / elapsed / 1e6;
+
+    if (json) {
+        printf("%s\n  {\"seconds\": %s, \"run\": %u, \"bytes\": %zu, "
+               "\"elapsed\": %.6f, \"mb_per_s\": %.1f, \"cpu\": %.6f, "
+               "\"switches\": %ld}",
+               first_result ? "[" : ",",
+               seconds, run, bytes, elapsed, rate, cpu, switches);
+    } else {
+        if (first_result)
+            printf("seconds,run,bytes,elapsed,mb_per_s,cpu,switches\n");
+        printf("%s,%u,%zu,%.6f,%.1f,%.6f,%ld\n",
+               seconds, run, bytes, elapsed, rate, cpu, switches);
+    }
+
+    first_result = false;
+}
+
+/*
+ * Import a track of the given length, and time it until the import
+ * has completed
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int bench(const char *importer, const char *seconds)
+{
+    unsigned int run;
+    char path[PATH_MAX];
+
+    if (audio == NULL) {
+        snprintf(path, sizeof path, "%s", seconds);
+    } else if (snprintf(path, sizeof path, "%s:%s", seconds, audio)
+               >= sizeof path)
+    {
+        fputs("Pathname of the audio is too long\n", stderr);
+        return -1;
+    }
+
+    for (run = 0; run < runs; run++) {
+        pthread_t rig;
+        struct track *t;
+        struct rusage before, after;
+        double start, elapsed;
+        bool importing;
+        size_t bytes;
+
+        if (rig_init() == -1)
+            return -1;
+
+        if (pthread_create(&rig, NULL, run_rig, NULL) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+
+        if (getrusage(RUSAGE_SELF, &before) == -1) {
+            perror("getrusage");
+            return -1;
+        }
+
+        start = now();
+
+        rig_lock();
+        t = track_acquire_by_import(importer, path, RATE);
+        rig_unlock();
+
+        if (t == NULL)
+            return -1;
+
+        do {
+            usleep(1000);
+
+            rig_lock();
+            importing = track_is_importing(t);
+            rig_unlock();
+        } while (importing);
+
+        elapsed = now() - start;
+
+        if (getrusage(RUSAGE_SELF, &after) == -1) {
+            perror("getrusage");
+            return -1;
+        }
+
+        bytes = (size_t)t->length * sizeof(signed short) * TRACK_CHANNELS;
+
+        if (rig_quit() == -1)
+            return -1;
+
+        if (pthread_join(rig, NULL) != 0)
+            abort();
+
+        track_release(t);
+        rig_clear();
+
+        /* The polling loop above accounts for about one switch for
+         * each millisecond */
+
+        report(seconds, run, bytes, elapsed, cpu(&after) - cpu(&before),
+               after.ru_nvcsw - before.ru_nvcsw
+               + after.ru_nivcsw - before.ru_nivcsw);
+    }
+
+    return 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-j] [-n <runs>] [-a <file>] "
+            "[<seconds> ...]\n\n"
+            "  -j  Output JSON, instead of CSV\n"
+            "  -n  Number of imports of each length (default %d)\n"
+            "  -a  Import the given raw audio, repeated, instead of a pattern\n",
+            argv0, DEFAULT_RUNS);
+}
+
+/*
+ * Manual benchmark of importing; by default, of tracks of 5 and
+ * 30 minutes
+ */
+
+int main(int argc, char *argv[])
+{
+    int c;
+    size_t n;
+    static const char *defaults[] = { "300", "1800" };
+
+    if (strcmp(basename(argv[0]), "import") == 0) {
+        if (argc < 3)
+            return EXIT_FAILURE;
+        return import(argv[1], argv[2]) == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    while ((c = getopt(argc, argv, "jn:a:")) != -1) {
+        switch (c) {
+        case 'a':
+            audio = optarg;
+            break;
+        case 'j':
+            json = true;
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (thread_global_init() == -1)
+        return -1;
+
+    if (optind == argc) {
+        for (n = 0; n < ARRAY_SIZE(defaults); n++) {
+            if (bench("/proc/self/exe", defaults[n]) == -1)
+                return -1;
+        }
+    } else {
+        for (n = optind; n < argc; n++) {
+            if (atoi(argv[n]) <= 0) {
+                usage(argv[0]);
+                return -1;
+            }
+
+            if (bench("/proc/self/exe", argv[n]) == -1)
+                return -1;
+        }
+    }
+
+    if (json)
+        printf("%s\n", first_result ? "[]" : "\n]");
+
+    thread_global_clear();
+
+    return 0;
+}
@@ -0,0 +1,539 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Benchmark of the drawing of the interface, which needs no display
+ *
+ * The interface is compiled in here so that its drawing functions can
+ * be called directly. SDL's "dummy" video driver gives a surface in
+ * memory, and the decks are given dummy devices and synthetic tracks.
+ *
+ * This program is also its own import and cue handler; it is run as
+ * one of these by the decks.
+ */
+
+#define _GNU_SOURCE /* asprintf(), M_PI */
+#include <libgen.h>
+#include <locale.h>
+
+#include "interface.c"
+
+#include "dummy.h"
+#include "realtime.h"
+#include "thread.h"
+
+#define DECKS 3
+#define RECORDS 5000
+#define DEFAULT_FRAMES 2000
+#define DEFAULT_DURATION "300" /* seconds of synthetic audio */
+
+char *banner = "xwax interface benchmark";
+
+size_t ndeck;
+struct deck deck[DECKS];
+
+struct timing {
+    const char *widget;
+    double total, worst; /* microseconds */
+};
+
+static bool json;
+static bool first_result = true;
+static unsigned int frames = DEFAULT_FRAMES;
+
+/*
+ * Act as an importer: write the given number of seconds of audio to
+ * standard output, with beats, a bassline and noise so that every
+ * frequency band is used
+ */
+
+static int import(const char *seconds, const char *rate)
+{
+    unsigned int n, length, r;
+    signed short buf[2048 * TRACK_CHANNELS];
+    size_t fill;
+    uint32_t noise;
+
+    r = atoi(rate);
+    length = atoi(seconds) * r;
+    noise = 2463534242u;
+    fill = 0;
+
+    for (n = 0; n < length; n++) {
+        double t, beat, v;
+
+        t = (double)n / r;
+        beat = fmod(t, 0.5); /* 120 BPM */
+
+        noise ^= noise << 13;
+        noise ^= noise >> 17;
+        noise ^= noise << 5;
+
+        v = sin(2 * M_PI * 50 * t) * exp(-beat * 12) * 0.6
+            + sin(2 * M_PI * 440 * t) * (fmod(t, 4.0) < 2.0 ? 0.2 : 0.05)
+            + ((int)(noise & 0xffff) - 0x8000) / 32768.0
+              * (beat > 0.25 && beat < 0.3 ? 0.3 : 0.02);
+
+        buf[fill++] = v * 20000;
+        buf[fill++] = v * 20000;
+
+        if (fill == sizeof buf / sizeof *buf) {
+            if (fwrite(buf, sizeof *buf, fill, stdout) != fill)
+                return -1;
+            fill = 0;
+        }
+    }
+
+    if (fwrite(buf, sizeof *buf, fill, stdout) != fill)
+        return -1;
+
+    return 0;
+}
+
+static void* run_rig(void *p)
+{
+    if (rig_main() == -1)
+        abort();
+
+    return NULL;
+}
+
+/*
+ * Load a synthetic track into each deck, and return when they have
+ * all been imported
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int load_decks(struct record *record)
+{
+    size_t n;
+    pthread_t rig;
+    bool importing;
+
+    if (pthread_create(&rig, NULL, run_rig, NULL) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+
+    rig_lock();
+    for (n = 0; n < ndeck; n++)
+        deck_load(&deck[n], record);
+    rig_unlock();
+
+    do {
+        usleep(10000);
+
+        importing = false;
+        rig_lock();
+        for (n = 0; n < ndeck; n++) {
+            if (track_is_importing(deck[n].player.track))
+                importing = true;
+        }
+        rig_unlock();
+    } while (importing);
+
+    if (rig_quit() == -1)
+        return -1;
+
+    if (pthread_join(rig, NULL) != 0)
+        abort();
+
+    return 0;
+}
+
+/*
+ * Fill the library with records, so that the selector has something
+ * to show
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int fill_library(struct library *lib)
+{
+    unsigned int n;
+
+    for (n = 0; n < RECORDS; n++) {
+        char *line;
+        struct record *r;
+
+        if (asprintf(&line, "/music/%u.mp3\tArtist %u\tTrack number %u"
+                     "\t%0.1f", n, n % 97, n, 100.0 + n % 60) == -1)
+        {
+            perror("asprintf");
+            return -1;
+        }
+
+        r = get_record(line);
+        if (r == NULL)
+            return -1;
+
+        if (listing_add(&lib->storage, r) == NULL)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Set up the interface as interface_start() does, but without the
+ * interface thread
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int start(struct library *lib)
+{
+    size_t n;
+
+    for (n = 0; n < ndeck; n++) {
+        if (timecoder_monitor_init(&deck[n].timecoder, zoom(SCOPE_SIZE)) == -1)
+            return -1;
+    }
+
+    view = calloc(ndeck, sizeof *view);
+    snapshot.deck = calloc(ndeck, sizeof *snapshot.deck);
+    if (view == NULL || snapshot.deck == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    if (init_spinner(zoom(SPINNER_SIZE)) == -1)
+        return -1;
+
+    init_band_colours();
+    selector_init(&selector, lib);
+
+    if (SDL_Init(SDL_INIT_VIDEO) == -1) {
+        fprintf(stderr, "%s\n", SDL_GetError());
+        return -1;
+    }
+
+    if (TTF_Init() == -1) {
+        fprintf(stderr, "%s\n", TTF_GetError());
+        return -1;
+    }
+
+    if (load_fonts() == -1)
+        return -1;
+
+    text_cache_init();
+
+    utf = iconv_open("UTF8", "");
+    if (utf == (iconv_t)-1) {
+        perror("iconv_open");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void stop(void)
+{
+    size_t n;
+
+    for (n = 0; n < ndeck; n++)
+        timecoder_monitor_clear(&deck[n].timecoder);
+
+    invalidate_decks();
+    free(view);
+
+    rig_lock();
+    release_snapshot(&snapshot);
+    rig_unlock();
+
+    free(snapshot.deck);
+    free(snapshot.crate);
+    free(snapshot.record);
+
+    clear_spinner();
+    selector_clear(&selector);
+    text_cache_flush();
+    clear_fonts();
+
+    if (iconv_close(utf) == -1)
+        abort();
+
+    TTF_Quit();
+    SDL_Quit();
+}
+
+/*
+ * Print the result of one widget
+ */
+
+static void report(int w, int h, const struct timing *t)
+{
+    double per;
+
+    per = t->total / frames;
+
+    if (json) {
+        printf("%s\n  {\"width\": %d, \"height\": %d, \"widget\": \"%s\", "
+               "\"frames\": %u, \"seconds\": %.6f, \"us_per_frame\": %.3f, "
+               "\"worst_us\": %.3f}",
+               first_result ? "[" : ",",
+               w, h, t->widget, frames, t->total / 1e6, per, t->worst);
+    } else {
+        if (first_result)
+            printf("width,height,widget,frames,seconds,us_per_frame,worst_us\n");
+        printf("%d,%d,%s,%u,%.6f,%.3f,%.3f\n",
+               w, h, t->widget, frames, t->total / 1e6, per, t->worst);
+    }
+
+    first_result = false;
+}
+
+static void account(struct timing *t, double start)
+{
+    double d;
+
+    d = now_us() - start;
+    t->total += d;
+    if (d > t->worst)
+        t->worst = d;
+}
+
+/*
+ * Draw the given number of frames at one size of window, as the
+ * decks play and the selector is scrolled
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int bench(int w, int h)
+{
+    unsigned int f;
+    size_t n;
+    SDL_Surface *surface;
+    struct rect rworkspace, rplayers, rlibrary, rstatus, rtmp;
+    struct timing snap = { "snapshot" },
+        decks = { "decks" },
+        library = { "library" },
+        status = { "status" },
+        update = { "update" };
+
+    surface = set_size(w, h, &rworkspace);
+    if (surface == NULL)
+        return -1;
+
+    invalidate_decks();
+
+    split(rworkspace, from_top(LIBRARY_HEIGHT + STATUS_HEIGHT + SPACER, SPACER), &rtmp, &rplayers);
+    split(rtmp, from_bottom(STATUS_HEIGHT, SPACER), &rlibrary, &rstatus);
+
+    for (n = 0; n < ndeck; n++)
+        player_seek_to(&deck[n].player, 30.0 * n);
+
+    for (f = 0; f < frames; f++) {
+        double t;
+        unsigned int rows;
+
+        /* Each deck plays at a slightly different speed */
+
+        for (n = 0; n < ndeck; n++)
+            deck[n].player.position += (1.0 + 0.01 * n) * REFRESH / 1000;
+
+        if (f % 100 == 0)
+            status_printf(STATUS_INFO, "Frame %u of %u", f, frames);
+
+        t = now_us();
+        rig_lock();
+        selector_down(&selector);
+        rows = library_rows(&rlibrary);
+        selector_set_lines(&selector, rows > 0 ? rows : 1);
+        if (snapshot_library(&snapshot, &selector, rows) == -1)
+            return -1;
+        snapshot_status(&snapshot);
+        snapshot_decks(&snapshot);
+        rig_unlock();
+        account(&snap, t);
+
+        LOCK(surface);
+
+        t = now_us();
+        draw_decks(surface, &rplayers, deck, snapshot.deck, ndeck,
+                   meter_scale);
+        account(&decks, t);
+
+        t = now_us();
+        draw_library(surface, &rlibrary, &snapshot);
+        account(&library, t);
+
+        t = now_us();
+        draw_status(surface, &rstatus, &snapshot);
+        account(&status, t);
+
+        UNLOCK(surface);
+
+        t = now_us();
+        UPDATE(surface, &rlibrary);
+        UPDATE(surface, &rstatus);
+        update_damage(surface, &rplayers);
+        account(&update, t);
+    }
+
+    report(w, h, &snap);
+    report(w, h, &decks);
+    report(w, h, &library);
+    report(w, h, &status);
+    report(w, h, &update);
+
+    return 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-j] [-n <frames>] [<width>x<height> ...]\n\n"
+            "  -j  Output JSON, instead of CSV\n"
+            "  -n  Number of frames to draw at each size (default %d)\n",
+            argv0, DEFAULT_FRAMES);
+}
+
+/*
+ * Manual benchmark of the interface; by default, at some common
+ * sizes of window
+ */
+
+int main(int argc, char *argv[])
+{
+    int c, n;
+    const char *self;
+    struct rt rt;
+    struct library lib;
+    struct record record;
+    struct timecode_def *def;
+    static const int defaults[][2] = {
+        { 640, 480 }, { 960, 720 }, { 1280, 720 }, { 1920, 1080 }
+    };
+
+    if (strcmp(basename(argv[0]), "import") == 0) {
+        if (argc != 3)
+            return EXIT_FAILURE;
+        return import(argv[1], argv[2]) == -1 ? EXIT_FAILURE : 0;
+    }
+
+    if (strcmp(basename(argv[0]), "cueloader") == 0)
+        return 0; /* no cues */
+
+    while ((c = getopt(argc, argv, "jn:")) != -1) {
+        switch (c) {
+        case 'j':
+            json = true;
+            break;
+        case 'n':
+            frames = atoi(optarg);
+            if (frames == 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    /* No display is needed */
+
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+
+    if (setlocale(LC_ALL, "") == NULL) {
+        fputs("Could not honour the local encoding\n", stderr);
+        return -1;
+    }
+
+    if (thread_global_init() == -1)
+        return -1;
+    if (library_global_init() == -1)
+        return -1;
+    if (rig_init() == -1)
+        return -1;
+    rt_init(&rt);
+    if (library_init(&lib) == -1)
+        return -1;
+
+    if (fill_library(&lib) == -1)
+        return -1;
+
+    def = timecoder_find_definition("serato_2a");
+    if (def == NULL)
+        return -1;
+
+    self = "/proc/self/exe";
+
+    for (ndeck = 0; ndeck < DECKS; ndeck++) {
+        struct deck *d;
+
+        d = &deck[ndeck];
+        dummy_init(&d->device);
+        if (deck_init(d, &rt, def, self, self, false, 1.0, false, false) == -1)
+            return -1;
+    }
+
+    record.pathname = (char*)DEFAULT_DURATION;
+    record.artist = (char*)"Synthetic";
+    record.title = (char*)"Beats, bass and noise";
+    record.match = NULL;
+    record.bpm = 120.0;
+
+    fputs("Importing...\n", stderr);
+
+    if (load_decks(&record) == -1)
+        return -1;
+
+    if (start(&lib) == -1)
+        return -1;
+
+    if (optind == argc) {
+        for (n = 0; n < sizeof defaults / sizeof *defaults; n++) {
+            if (bench(defaults[n][0], defaults[n][1]) == -1)
+                return -1;
+        }
+    } else {
+        for (n = optind; n < argc; n++) {
+            int w, h;
+
+            if (sscanf(argv[n], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+                usage(argv[0]);
+                return -1;
+            }
+
+            if (bench(w, h) == -1)
+                return -1;
+        }
+    }
+
+    if (json)
+        printf("%s\n", first_result ? "[]" : "\n]");
+
+    stop();
+
+    for (n = 0; n < ndeck; n++)
+        deck_clear(&deck[n]);
+
+    timecoder_free_lookup();
+    library_clear(&lib);
+    rt_clear(&rt);
+    rig_clear();
+    library_global_clear();
+    thread_global_clear();
+
+    return 0;
+}
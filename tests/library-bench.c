@@ -0,0 +1,455 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Benchmark of the record library, from parsing the output of a scan
+ * through to searching in the selector
+ *
+ * The crates are synthetic, but artists and words in titles are
+ * chosen with a Zipf-like distribution so that a few are very common,
+ * as in a real collection. The same seed gives the same crates, so
+ * results can be compared from one build to the next.
+ */
+
+#define _GNU_SOURCE /* asprintf() */
+#include <locale.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "library.h"
+#include "selector.h"
+#include "thread.h"
+
+#define ARTISTS_PER_RECORD 0.05
+
+static const char *syllables[] = {
+    "ka", "lo", "mi", "dre", "son", "vel", "tra", "nu", "bex", "ri",
+    "an", "to", "zé", "ma", "dj", "or", "el", "kö", "sy", "ph"
+};
+
+static const char *words[] = {
+    "love", "night", "the", "of", "dance", "remix", "you", "me", "dub",
+    "original", "mix", "in", "fire", "heart", "deep", "light", "city",
+    "dream", "feat", "edit", "sound", "time", "music", "world", "baby",
+    "rain", "summer", "girl", "funk", "soul", "house", "blue", "high",
+    "black", "sun", "run", "gold", "star", "vocal", "part"
+};
+
+static const char *queries[] = {
+    "l", "lo", "love", "the night", "remix", "ka mi", "deep dub edit",
+    "zzz"
+};
+
+static const char *typed = "love remix";
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+static bool json;
+static bool first_result = true;
+static uint64_t seed = 88172645463325252ULL;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static bool searched;
+
+/*
+ * Return: pseudo-random number, from a fixed sequence
+ */
+
+static uint64_t next_random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+/*
+ * Return: random number in the range [0.0, 1.0)
+ */
+
+static double uniform(void)
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Return: random number in the range [0, n), where lower numbers
+ * are much more likely
+ */
+
+static size_t zipf(size_t n)
+{
+    size_t r;
+
+    r = (size_t)pow(n, uniform()) - 1;
+    return r < n ? r : n - 1;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+        perror("clock_gettime");
+        abort();
+    }
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Print the result of a single measurement
+ */
+
+static void report(size_t records, const char *op, const char *arg,
+                   size_t count, double seconds)
+{
+    double per;
+
+    per = count > 0 ? seconds / count * 1e6 : 0.0;
+
+    if (json) {
+        printf("%s\n  {\"records\": %zu, \"op\": \"%s\", \"arg\": \"%s\", "
+               "\"count\": %zu, \"seconds\": %.6f, \"us_per_op\": %.3f}",
+               first_result ? "[" : ",",
+               records, op, arg, count, seconds, per);
+    } else {
+        if (first_result)
+            printf("records,op,arg,count,seconds,us_per_op\n");
+        printf("%zu,%s,\"%s\",%zu,%.6f,%.3f\n",
+               records, op, arg, count, seconds, per);
+    }
+
+    first_result = false;
+}
+
+/*
+ * Return: name of an artist, or NULL on memory allocation failure
+ */
+
+static char* make_artist(size_t n)
+{
+    char buf[64];
+    size_t len;
+
+    len = 0;
+    buf[0] = '\0';
+
+    if (n % 11 == 0)
+        len += sprintf(buf + len, "The ");
+
+    do {
+        len += sprintf(buf + len, "%s", syllables[n % ARRAY_SIZE(syllables)]);
+        n /= ARRAY_SIZE(syllables);
+    } while (n > 0 && len < sizeof(buf) - 8);
+
+    buf[0] = buf[0] >= 'a' && buf[0] <= 'z' ? buf[0] - 'a' + 'A' : buf[0];
+
+    return strdup(buf);
+}
+
+/*
+ * Generate one line of output, as if from a scan script
+ *
+ * Return: line, or NULL on memory allocation failure
+ */
+
+static char* make_line(size_t n, char **artist, size_t artists)
+{
+    size_t w, nwords, len;
+    char title[256], bpm[16], *s;
+
+    nwords = 1 + next_random() % 4;
+    len = 0;
+    for (w = 0; w < nwords; w++) {
+        len += sprintf(title + len, "%s%s", w > 0 ? " " : "",
+                       words[zipf(ARRAY_SIZE(words))]);
+    }
+
+    /* Some tracks have not been analysed */
+
+    if (next_random() % 10 == 0) {
+        bpm[0] = '\0';
+    } else {
+        double x;
+
+        x = 124.0 + (uniform() + uniform() + uniform() - 1.5) * 40.0;
+        sprintf(bpm, "\t%0.1f", x);
+    }
+
+    if (asprintf(&s, "/music/%zu/%zu.mp3\t%s\t%s%s", n % 997, n,
+                 artist[zipf(artists)], title, bpm) == -1)
+    {
+        perror("asprintf");
+        return NULL;
+    }
+
+    return s;
+}
+
+/*
+ * Generate the given number of lines in the scan format
+ *
+ * Return: array of lines, or NULL on memory allocation failure
+ */
+
+static char** generate(size_t records)
+{
+    size_t n, artists;
+    char **line, **artist;
+
+    artists = records * ARTISTS_PER_RECORD + 1;
+
+    artist = malloc(sizeof(char*) * artists);
+    line = malloc(sizeof(char*) * records);
+    if (artist == NULL || line == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    for (n = 0; n < artists; n++) {
+        artist[n] = make_artist(n);
+        if (artist[n] == NULL)
+            return NULL;
+    }
+
+    for (n = 0; n < records; n++) {
+        line[n] = make_line(n, artist, artists);
+        if (line[n] == NULL)
+            return NULL;
+    }
+
+    for (n = 0; n < artists; n++)
+        free(artist[n]);
+    free(artist);
+
+    return line;
+}
+
+static void handle_searched(struct observer *o, void *x)
+{
+    pthread_mutex_lock(&lock);
+    searched = true;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Wait for the selector to finish any search in the background
+ */
+
+static void wait_for_search(struct selector *sel)
+{
+    if (!sel->searching)
+        return;
+
+    pthread_mutex_lock(&lock);
+    while (!searched)
+        pthread_cond_wait(&cond, &lock);
+    searched = false;
+    pthread_mutex_unlock(&lock);
+
+    selector_collect(sel);
+}
+
+/*
+ * Time each stage of the library for a crate of the given size
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int bench(size_t records)
+{
+    size_t n, len;
+    double start;
+    char **line;
+    struct record **re;
+    struct library lib;
+    struct selector sel;
+    struct observer on_searched;
+
+    line = generate(records);
+    if (line == NULL)
+        return -1;
+
+    re = malloc(sizeof(struct record*) * records);
+    if (re == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    if (library_init(&lib) == -1)
+        return -1;
+
+    /* Parse, as done for each line output by a scan */
+
+    start = now();
+    for (n = 0; n < records; n++) {
+        re[n] = get_record(line[n]);
+        if (re[n] == NULL)
+            return -1;
+    }
+    report(records, "get_record", "", records, now() - start);
+
+    start = now();
+    for (n = 0; n < records; n++) {
+        if (listing_add(&lib.storage, re[n]) != re[n])
+            return -1; /* pathnames are unique */
+    }
+    report(records, "listing_add", "", records, now() - start);
+
+    free(re);
+    free(line); /* the lines themselves belong to the records */
+
+    for (n = 0; n < ARRAY_SIZE(queries); n++) {
+        struct match match;
+        struct index result;
+
+        index_init(&result);
+        match_compile(&match, queries[n]);
+
+        start = now();
+        if (index_match(&lib.storage.by_artist, &result, &match) == -1)
+            return -1;
+        report(records, "index_match", queries[n], 1, now() - start);
+
+        index_clear(&result);
+    }
+
+    start = now();
+    selector_init(&sel, &lib);
+    report(records, "selector_init", "", 1, now() - start);
+
+    watch(&on_searched, &sel.searched, handle_searched);
+
+    /* Type, then delete, a search; wait for each keypress to take
+     * effect, as seen by the user */
+
+    len = strlen(typed);
+
+    start = now();
+    for (n = 0; n < len; n++) {
+        selector_search_refine(&sel, typed[n]);
+        wait_for_search(&sel);
+    }
+    report(records, "selector_search_refine", typed, len, now() - start);
+
+    start = now();
+    for (n = 0; n < len; n++) {
+        selector_search_expand(&sel);
+        wait_for_search(&sel);
+    }
+    report(records, "selector_search_expand", typed, len, now() - start);
+
+    /* Cycle through every sort order, twice; the second time round
+     * may use the results of the first */
+
+    start = now();
+    for (n = 0; n < SORT_END; n++)
+        selector_toggle_order(&sel);
+    report(records, "selector_toggle_order", "", SORT_END, now() - start);
+
+    start = now();
+    for (n = 0; n < SORT_END; n++)
+        selector_toggle_order(&sel);
+    report(records, "selector_toggle_order", "again", SORT_END,
+           now() - start);
+
+    ignore(&on_searched);
+    selector_clear(&sel);
+    library_clear(&lib);
+
+    return 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-j] [<records> ...]\n\n"
+            "  -j  Output JSON, instead of CSV\n", argv0);
+}
+
+/*
+ * Manual benchmark of the record library; by default, for crates of
+ * 10,000, 100,000 and 1,000,000 records
+ */
+
+int main(int argc, char *argv[])
+{
+    int c;
+    size_t n;
+    static const size_t defaults[] = { 10000, 100000, 1000000 };
+
+    while ((c = getopt(argc, argv, "j")) != -1) {
+        switch (c) {
+        case 'j':
+            json = true;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (setlocale(LC_ALL, "") == NULL) {
+        fputs("Could not honour the local encoding\n", stderr);
+        return -1;
+    }
+
+    if (thread_global_init() == -1)
+        return -1;
+    if (library_global_init() == -1)
+        return -1;
+
+    if (optind == argc) {
+        for (n = 0; n < ARRAY_SIZE(defaults); n++) {
+            if (bench(defaults[n]) == -1)
+                return -1;
+        }
+    } else {
+        for (n = optind; n < argc; n++) {
+            unsigned long records;
+            char *end;
+
+            records = strtoul(argv[n], &end, 10);
+            if (*end != '\0' || records == 0) {
+                usage(argv[0]);
+                return -1;
+            }
+
+            if (bench(records) == -1)
+                return -1;
+        }
+    }
+
+    if (json)
+        printf("%s\n", first_result ? "[]" : "\n]");
+
+    library_global_clear();
+    thread_global_clear();
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "matcher.h"
+#include "thread.h"
+
+#define RECORDS 100000
+
+static const char *words[] = {
+    "apple", "orange", "lemon", "carrot", "onion", "potato", "pear"
+};
+
+#define WORDS (sizeof(words) / sizeof(*words))
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int completed;
+
+static void callback(struct observer *o, void *x)
+{
+    pthread_mutex_lock(&lock);
+    completed++;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static void wait_for_completion(void)
+{
+    pthread_mutex_lock(&lock);
+    while (completed == 0)
+        pthread_cond_wait(&cond, &lock);
+    completed = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Search in the background and compare against index_match()
+ */
+
+static int check(struct matcher *m, struct index *all, const char *search)
+{
+    size_t n;
+    struct match match;
+    struct index expect, result;
+
+    index_init(&expect);
+    index_init(&result);
+
+    match_compile(&match, search);
+
+    if (index_match(all, &expect, &match) == -1)
+        return -1;
+
+    if (matcher_submit(m, all, &match) == -1)
+        return -1;
+
+    wait_for_completion();
+
+    if (!matcher_collect(m, &result)) {
+        fprintf(stderr, "%s: no result\n", search);
+        return -1;
+    }
+
+    printf("'%s': %zu matches\n", search, result.entries);
+
+    if (result.entries != expect.entries) {
+        fprintf(stderr, "%s: expected %zu matches\n", search, expect.entries);
+        return -1;
+    }
+
+    for (n = 0; n < expect.entries; n++) {
+        if (result.record[n] != expect.record[n]) {
+            fprintf(stderr, "%s: mismatch at %zu\n", search, n);
+            return -1;
+        }
+    }
+
+    index_clear(&expect);
+    index_clear(&result);
+
+    return 0;
+}
+
+/*
+ * Manual test of the background search; compare the results with
+ * a search in the calling thread
+ */
+
+int main(int argc, char *argv[])
+{
+    size_t n;
+    struct record *re;
+    struct index all;
+    struct matcher m;
+    struct observer o;
+    struct match match;
+
+    if (thread_global_init() == -1)
+        return -1;
+
+    re = malloc(sizeof(struct record) * RECORDS);
+    if (re == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    index_init(&all);
+    if (index_reserve(&all, RECORDS) == -1)
+        return -1;
+
+    for (n = 0; n < RECORDS; n++) {
+        char buf[128];
+
+        sprintf(buf, "%s %zu", words[n % WORDS], n);
+        re[n].pathname = strdup(buf);
+        re[n].artist = (char*)words[(n / WORDS) % WORDS];
+        re[n].title = re[n].pathname;
+        re[n].match = NULL;
+        re[n].bpm = 0.0;
+
+        index_add(&all, &re[n]);
+    }
+
+    if (matcher_init(&m) == -1)
+        return -1;
+
+    watch(&o, &m.completion, callback);
+
+    if (check(&m, &all, "") == -1)
+        return -1;
+    if (check(&m, &all, "apple") == -1)
+        return -1;
+    if (check(&m, &all, "lemon carrot") == -1)
+        return -1;
+    if (check(&m, &all, "pear 99") == -1)
+        return -1;
+    if (check(&m, &all, "banana") == -1)
+        return -1;
+
+    /* A cancelled search must not be collected */
+
+    match_compile(&match, "onion");
+    if (matcher_submit(&m, &all, &match) == -1)
+        return -1;
+    matcher_cancel(&m);
+
+    if (matcher_collect(&m, &all)) {
+        fprintf(stderr, "collected a cancelled search\n");
+        return -1;
+    }
+
+    ignore(&o);
+    matcher_clear(&m);
+
+    for (n = 0; n < RECORDS; n++)
+        free(re[n].pathname);
+    free(re);
+    index_clear(&all);
+
+    thread_global_clear();
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2018 Mark Hills <mark@xwax.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "store.h"
+#include "thread.h"
+
+#define TRACKS 2000
+
+static struct store store = STORE_INIT("cues");
+
+/*
+ * Self-contained test of the store of cue points, which are kept
+ * after the file is closed and opened again
+ */
+
+int main(int argc, char *argv[])
+{
+    char pathname[] = "/tmp/xwax-cues-XXXXXX", path[32];
+    double p[3];
+    size_t n, round;
+    int fd, c;
+    FILE *f;
+
+    if (thread_global_init() == -1)
+        return -1;
+
+    fd = mkstemp(pathname);
+    if (fd == -1) {
+        perror("mkstemp");
+        return -1;
+    }
+    close(fd);
+
+    if (store_open(&store, pathname) == -1)
+        return -1;
+
+    assert(store_get(&store, "/music/a.mp3", p, 3) == 0);
+
+    /* Save each track many times, so that the file is tidied when
+     * it is opened again */
+
+    for (round = 0; round < 3; round++) {
+        for (n = 0; n < TRACKS; n++) {
+            sprintf(path, "/music/%zu.mp3", n);
+            p[0] = HUGE_VAL;
+            p[1] = n + round;
+            p[2] = HUGE_VAL;
+            store_put(&store, path, p, 3);
+        }
+    }
+
+    /* A track with every cue point cleared */
+
+    p[0] = 1.0;
+    store_put(&store, "/music/a.mp3", p, 1);
+    p[0] = HUGE_VAL;
+    store_put(&store, "/music/a.mp3", p, 1);
+
+    store_close(&store);
+
+    if (store_open(&store, pathname) == -1)
+        return -1;
+
+    for (n = 0; n < TRACKS; n++) {
+        sprintf(path, "/music/%zu.mp3", n);
+        assert(store_get(&store, path, p, 3) == 2);
+        assert(p[0] == HUGE_VAL);
+        assert(p[1] == n + 2);
+    }
+
+    assert(store_get(&store, "/music/a.mp3", p, 3) == 0);
+
+    store_close(&store);
+
+    /* Only the latest line for each track remains */
+
+    f = fopen(pathname, "r");
+    if (f == NULL) {
+        perror("fopen");
+        return -1;
+    }
+
+    n = 0;
+    while ((c = fgetc(f)) != EOF) {
+        if (c == '\n')
+            n++;
+    }
+    fclose(f);
+
+    assert(n == TRACKS);
+
+    thread_global_clear();
+
+    if (unlink(pathname) == -1) {
+        perror("unlink");
+        return -1;
+    }
+
+    return 0;
+}
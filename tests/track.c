@@ -23,6 +23,8 @@
 #include "thread.h"
 #include "track.h"
 
+#define RATE 44100
+
 /*
  * Self-contained manual test of a track import operation
  */
@@ -41,7 +43,7 @@ int main(int argc, char *argv[])
 
     rig_init();
 
-    track = track_acquire_by_import(argv[1], argv[2]);
+    track = track_acquire_by_import(argv[1], argv[2], RATE);
     if (track == NULL)
         return -1;
 
@@ -40,6 +40,8 @@
 #define VALID_BITS 24
 
 #define MONITOR_DECAY_EVERY 512 /* in samples */
+#define MONITOR_DECIMATE 4 /* plot one in every n samples */
+#define MONITOR_POINTS 4096 /* power of two */
 
 #define SQ(x) ((x)*(x))
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
@@ -309,15 +311,20 @@ void timecoder_init(struct timecoder *tc, struct timecode_def *def,
     tc->timecode_ticker = 0;
 
     tc->mon = NULL;
+    tc->mon_point = NULL;
 }
 
 /*
- * Clear resources associated with a timecode decoder
+ * Clear resources associated with a timecode decoder, including any
+ * monitor
+ *
+ * Pre: the realtime thread is not running
  */
 
 void timecoder_clear(struct timecoder *tc)
 {
-    assert(tc->mon == NULL);
+    if (tc->mon != NULL)
+        timecoder_monitor_clear(tc);
 }
 
 /*
@@ -331,7 +338,11 @@ void timecoder_clear(struct timecoder *tc)
 
 int timecoder_monitor_init(struct timecoder *tc, int size)
 {
+    unsigned short *point;
+
     assert(tc->mon == NULL);
+    assert(SQ(size) <= USHRT_MAX);
+
     tc->mon_size = size;
     tc->mon = malloc(SQ(tc->mon_size));
     if (tc->mon == NULL) {
@@ -339,21 +350,108 @@ int timecoder_monitor_init(struct timecoder *tc, int size)
         return -1;
     }
     memset(tc->mon, 0, SQ(tc->mon_size));
-    tc->mon_counter = 0;
+
+    point = malloc(sizeof *point * MONITOR_POINTS);
+    if (point == NULL) {
+        perror("malloc");
+        free(tc->mon);
+        tc->mon = NULL;
+        return -1;
+    }
+
+    tc->mon_head = 0;
+    tc->mon_tail = 0;
+    tc->mon_samples = 0;
+    tc->mon_decayed = 0;
+    tc->mon_skip = 0;
+
+    /* The realtime thread may already be running */
+
+    __atomic_store_n(&tc->mon_point, point, __ATOMIC_RELEASE);
     return 0;
 }
 
 /*
  * Clear the monitor on the given timecoder
+ *
+ * Pre: the realtime thread is not running
  */
 
 void timecoder_monitor_clear(struct timecoder *tc)
 {
     assert(tc->mon != NULL);
+
+    free(tc->mon_point);
+    tc->mon_point = NULL;
+
     free(tc->mon);
     tc->mon = NULL;
 }
 
+/*
+ * Bring the x-y array up to date with the incoming audio: decay it
+ * for the time which has passed, and plot the new points
+ *
+ * Return: true if the array has changed, otherwise false
+ * Pre: called from the same thread as timecoder_monitor_init()
+ */
+
+bool timecoder_monitor_update(struct timecoder *tc)
+{
+    unsigned int head, samples, decays;
+    bool changed;
+
+    assert(tc->mon != NULL);
+
+    head = __atomic_load_n(&tc->mon_head, __ATOMIC_ACQUIRE);
+    samples = __atomic_load_n(&tc->mon_samples, __ATOMIC_RELAXED);
+
+    changed = false;
+
+    decays = (samples - tc->mon_decayed) / MONITOR_DECAY_EVERY;
+    tc->mon_decayed += decays * MONITOR_DECAY_EVERY;
+
+    if (decays > 0) {
+        unsigned char decay[256];
+        int v, p;
+
+        /* Apply each of the decays in one pass */
+
+        for (v = 0; v < 256; v++) {
+            unsigned int n, x;
+
+            x = v;
+            for (n = 0; n < decays && x > 0; n++)
+                x = x * 7 / 8;
+            decay[v] = x;
+        }
+
+        for (p = 0; p < SQ(tc->mon_size); p++) {
+            if (tc->mon[p] == 0)
+                continue;
+
+            tc->mon[p] = decay[tc->mon[p]];
+            changed = true;
+        }
+    }
+
+    while (tc->mon_tail != head) {
+        unsigned char *px;
+
+        px = &tc->mon[tc->mon_point[tc->mon_tail % MONITOR_POINTS]];
+        if (*px != 0xff) {
+            *px = 0xff;
+            changed = true;
+        }
+
+        tc->mon_tail++;
+    }
+
+    __atomic_store_n(&tc->mon_tail, tc->mon_tail, __ATOMIC_RELEASE);
+
+    return changed;
+}
+
 /*
  * Update channel information with axis-crossings
  */
@@ -379,30 +477,28 @@ static void detect_zero_crossing(struct timecoder_channel *ch,
 }
 
 /*
- * Plot the given sample value in the x-y monitor
+ * Pass the given sample value to the x-y monitor
+ *
+ * Only some of the samples are passed, and they are dropped if the
+ * interface has not kept up.
  */
 
-static void update_monitor(struct timecoder *tc, signed int x, signed int y)
+static void plot_monitor(struct timecoder *tc, unsigned short *point,
+                         signed int x, signed int y)
 {
     int px, py, size, ref;
+    unsigned int head, tail;
+
+    __atomic_store_n(&tc->mon_samples, tc->mon_samples + 1,
+                     __ATOMIC_RELAXED);
 
-    if (!tc->mon)
+    if (++tc->mon_skip < MONITOR_DECIMATE)
         return;
+    tc->mon_skip = 0;
 
     size = tc->mon_size;
     ref = tc->ref_level;
 
-    /* Decay the pixels already in the montior */
-
-    if (++tc->mon_counter % MONITOR_DECAY_EVERY == 0) {
-        int p;
-
-        for (p = 0; p < SQ(size); p++) {
-            if (tc->mon[p])
-                tc->mon[p] = tc->mon[p] * 7 / 8;
-        }
-    }
-
     assert(ref > 0);
 
     /* ref_level is half the prevision of signal level */
@@ -412,7 +508,13 @@ static void update_monitor(struct timecoder *tc, signed int x, signed int y)
     if (px < 0 || px >= size || py < 0 || py >= size)
         return;
 
-    tc->mon[py * size + px] = 0xff; /* white */
+    head = tc->mon_head;
+    tail = __atomic_load_n(&tc->mon_tail, __ATOMIC_ACQUIRE);
+    if (head - tail == MONITOR_POINTS)
+        return; /* full */
+
+    point[head % MONITOR_POINTS] = py * size + px;
+    __atomic_store_n(&tc->mon_head, head + 1, __ATOMIC_RELEASE);
 }
 
 /*
@@ -571,6 +673,13 @@ void timecoder_cycle_definition(struct timecoder *tc)
 
 void timecoder_submit(struct timecoder *tc, signed short *pcm, size_t npcm)
 {
+    unsigned short *point;
+
+    /* The monitor may be started while we are running, but is not
+     * cleared until we have stopped */
+
+    point = __atomic_load_n(&tc->mon_point, __ATOMIC_ACQUIRE);
+
     while (npcm--) {
 	signed int left, right, primary, secondary;
 
@@ -586,7 +695,8 @@ void timecoder_submit(struct timecoder *tc, signed short *pcm, size_t npcm)
         }
 
 	process_sample(tc, primary, secondary);
-        update_monitor(tc, left, right);
+        if (point != NULL)
+            plot_monitor(tc, point, left, right);
 
         pcm += TIMECODER_CHANNELS;
     }
@@ -72,10 +72,17 @@ struct timecoder {
     unsigned int valid_counter, /* number of successful error checks */
         timecode_ticker; /* samples since valid timecode was read */
 
-    /* Feedback */
-
+    /* Feedback; points are passed from the realtime thread to the
+     * interface, which draws them into the x-y array */
+
+    unsigned short *mon_point; /* ring buffer of offsets into mon */
+    unsigned int mon_head, /* written only by the realtime thread */
+        mon_tail, /* written only by the interface */
+        mon_samples, /* count of samples seen */
+        mon_decayed, /* count of samples accounted for in mon */
+        mon_skip;
     unsigned char *mon; /* x-y array */
-    int mon_size, mon_counter;
+    int mon_size;
 };
 
 struct timecode_def* timecoder_find_definition(const char *name);
@@ -87,6 +94,7 @@ void timecoder_clear(struct timecoder *tc);
 
 int timecoder_monitor_init(struct timecoder *tc, int size);
 void timecoder_monitor_clear(struct timecoder *tc);
+bool timecoder_monitor_update(struct timecoder *tc);
 
 void timecoder_cycle_definition(struct timecoder *tc);
 void timecoder_submit(struct timecoder *tc, signed short *pcm, size_t npcm);
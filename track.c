@@ -17,10 +17,16 @@
  *
  */
 
+#define _GNU_SOURCE /* F_SETPIPE_SZ */
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/mman.h> /* mlock() */
@@ -28,22 +34,48 @@
 #include "debug.h"
 #include "external.h"
 #include "list.h"
+#include "pool.h"
 #include "realtime.h"
 #include "rig.h"
+#include "stats.h"
 #include "status.h"
 #include "track.h"
 
-#define RATE 44100
+#define EMPTY_RATE 44100
+
+/* Audio is imported ahead only when it is well ahead of the main
+ * import, and from a little before the cue point */
+
+#define AHEAD_MIN 30 /* seconds */
+#define AHEAD_PREROLL 2 /* seconds */
+
+/* A larger pipe than the default lets the importer run further ahead,
+ * and the rig take in more audio each time it is woken */
+
+#define IMPORT_PIPE (1024 * 1024) /* bytes */
+
+#define OVERVIEW_CHUNK 64 /* samples metered at a time */
 
 #define SAMPLE (sizeof(signed short) * TRACK_CHANNELS) /* bytes per sample */
 #define TRACK_BLOCK_PCM_BYTES (TRACK_BLOCK_SAMPLES * SAMPLE)
 
-#define _STR(tok) #tok
-#define STR(tok) _STR(tok)
-
 static struct list tracks = LIST_INIT(tracks);
+
+/* Imports waiting to run, in order of priority */
+
+static struct list queue = LIST_INIT(queue);
+static unsigned int running;
 static bool use_mlock = false;
 
+/* Measurements of every import which has run */
+
+static struct stats spawn = STATS_INIT("Time to start importer", "s", 1e-4),
+    first_audio = STATS_INIT("Time to first audio", "s", 1e-3),
+    first_block = STATS_INIT("Time to first block", "s", 1e-3),
+    decode = STATS_INIT("Time to import", "s", 1e-2),
+    throughput = STATS_INIT("Throughput", "MB/s", 0.1),
+    wakeups = STATS_INIT("Wakeups", "per MB", 1.0);
+
 /*
  * An empty track is used rarely, and is easier than
  * continuous checks for NULL throughout the code
@@ -52,12 +84,11 @@ static bool use_mlock = false;
 static struct track empty = {
     .refcount = 1,
 
-    .rate = RATE,
-    .bytes = 0,
+    .rate = EMPTY_RATE,
     .length = 0,
     .blocks = 0,
 
-    .pid = 0
+    .destroy = EVENT_INIT(empty.destroy)
 };
 
 /*
@@ -70,6 +101,36 @@ void track_use_mlock(void)
     use_mlock = true;
 }
 
+/*
+ * Write out the measurements of every import which has run
+ *
+ * Pre: rig lock is held, or the rig is not running
+ */
+
+void track_dump_stats(FILE *f)
+{
+    stats_dump(f, &spawn);
+    stats_dump(f, &first_audio);
+    stats_dump(f, &first_block);
+    stats_dump(f, &decode);
+    stats_dump(f, &throughput);
+    stats_dump(f, &wakeups);
+}
+
+/*
+ * Return: monotonic time, in seconds
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        abort();
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 /*
  * Allocate more memory
  *
@@ -87,9 +148,11 @@ static int more_space(struct track *tr)
         return -1;
     }
 
-    block = malloc(sizeof(struct track_block));
+    /* Audio which is yet to be imported is silent */
+
+    block = calloc(1, sizeof(struct track_block));
     if (block == NULL) {
-        perror("malloc");
+        perror("calloc");
         return -1;
     }
 
@@ -100,7 +163,8 @@ static int more_space(struct track *tr)
     }
 
     /* No memory barrier is needed here, because nobody else tries to
-     * access these blocks until tr->length is actually incremented */
+     * access these blocks until tr->length is actually incremented
+     * past them */
 
     tr->block[tr->blocks++] = block;
 
@@ -110,86 +174,308 @@ static int more_space(struct track *tr)
     return 0;
 }
 
+/*
+ * Return: true if the main import must stop where the import ahead
+ * began, otherwise false
+ */
+
+static bool ahead_of(const struct track *tr, const struct track_import *im)
+{
+    if (im != &tr->import || tr->ahead.start == 0)
+        return false;
+
+    /* If the import ahead failed, the main import continues
+     * through its audio */
+
+    return tr->ahead.pid != 0 || tr->ahead.complete;
+}
+
+/*
+ * Return: the sample after the last one from the given import
+ */
+
+static unsigned int import_end(const struct track_import *im)
+{
+    return im->start + im->bytes / SAMPLE;
+}
+
 /*
  * Get access to the PCM buffer for incoming audio
  *
- * Return: pointer to buffer
+ * Return: pointer to buffer, or NULL on error
  * Post: len contains the length of the buffer, in bytes
  */
 
-static void* access_pcm(struct track *tr, size_t *len)
+static void* access_pcm(struct track *tr, struct track_import *im,
+                        size_t *len)
 {
     unsigned int block;
-    size_t fill;
+    size_t pos, fill;
 
-    block = tr->bytes / TRACK_BLOCK_PCM_BYTES;
-    if (block == tr->blocks) {
+    pos = (size_t)im->start * SAMPLE + im->bytes;
+    block = pos / TRACK_BLOCK_PCM_BYTES;
+
+    while (block >= tr->blocks) {
         if (more_space(tr) == -1)
             return NULL;
     }
 
-    fill = tr->bytes % TRACK_BLOCK_PCM_BYTES;
+    fill = pos % TRACK_BLOCK_PCM_BYTES;
     *len = TRACK_BLOCK_PCM_BYTES - fill;
 
+    if (ahead_of(tr, im)) {
+        size_t end;
+
+        end = (size_t)tr->ahead.start * SAMPLE;
+        assert(pos < end);
+        if (*len > end - pos)
+            *len = end - pos;
+    }
+
     return (void*)tr->block[block]->pcm + fill;
 }
 
 /*
- * Notify that audio has been placed in the buffer
+ * Summarise some audio, without using the levels which have been
+ * calculated already
+ */
+
+static void summarise(const signed short *pcm, unsigned int samples,
+                      struct track_peak *peak)
+{
+    int min, max;
+    unsigned int n;
+    unsigned long long sq;
+
+    assert(samples > 0);
+
+    min = INT_MAX;
+    max = INT_MIN;
+    sq = 0;
+
+    /* Written so that the compiler can vectorise it; each square
+     * fits in 32 bits */
+
+    for (n = 0; n < samples; n++) {
+        int v;
+
+        v = (pcm[n * 2] + pcm[n * 2 + 1]) / 2;
+
+        min = v < min ? v : min;
+        max = v > max ? v : max;
+        sq += (unsigned int)(v * v);
+    }
+
+    peak->min = min >> 8;
+    peak->max = max >> 8;
+    peak->rms = (unsigned int)sqrt((double)sq / samples) >> 8;
+}
+
+/*
+ * Update the waveform summary of a block, after new audio from
+ * sample 'start' (inclusive) to 'end' (exclusive)
  *
- * The parameter is the number of stereo samples which have been
- * placed in the buffer.
+ * The last summary at each level may be of an incomplete range, and
+ * is calculated again as more audio arrives.
  */
 
-static void commit_pcm_samples(struct track *tr, unsigned int samples)
+static void update_peaks(struct track_block *b, unsigned int start,
+                         unsigned int end)
 {
-    unsigned int fill, n;
-    signed short *pcm;
-    struct track_block *block;
+    int level;
+    unsigned int n, last;
+    struct track_peak *p, *child;
 
-    block = tr->block[tr->length / TRACK_BLOCK_SAMPLES];
-    fill = tr->length % TRACK_BLOCK_SAMPLES;
-    pcm = block->pcm + TRACK_CHANNELS * fill;
+    assert(end > start);
 
-    assert(samples <= TRACK_BLOCK_SAMPLES - fill);
+    /* The first level is from the audio itself */
 
-    /* Meter the new audio */
+    p = &b->peak[track_peak_offset(TRACK_PEAK_MIN)];
+    last = (end - 1) >> TRACK_PEAK_MIN;
 
-    for (n = samples; n > 0; n--) {
-        unsigned short v;
-        unsigned int w;
+    for (n = start >> TRACK_PEAK_MIN; n <= last; n++) {
+        unsigned int s, len;
 
-        v = abs(pcm[0]) + abs(pcm[1]);
+        s = n << TRACK_PEAK_MIN;
+        len = 1 << TRACK_PEAK_MIN;
+        if (s + len > end)
+            len = end - s;
 
-        /* PPM-style fast meter approximation */
+        summarise(&b->pcm[s * TRACK_CHANNELS], len, &p[n]);
+    }
 
-        if (v > tr->ppm)
-            tr->ppm += (v - tr->ppm) >> 3;
-        else
-            tr->ppm -= (tr->ppm - v) >> 9;
+    /* Then each level from the one below */
 
-        block->ppm[fill / TRACK_PPM_RES] = tr->ppm >> 8;
+    for (level = TRACK_PEAK_MIN + 1; level <= TRACK_PEAK_MAX; level++) {
+        child = p;
+        p = &b->peak[track_peak_offset(level)];
+        last = (end - 1) >> level;
 
-        /* Update the slow-metering overview. Fixed point arithmetic
-         * going on here */
+        for (n = start >> level; n <= last; n++) {
+            const struct track_peak *x, *y;
 
-        w = v << 16;
+            x = &child[n * 2];
+            y = &child[n * 2 + 1];
 
-        if (w > tr->overview)
-            tr->overview += (w - tr->overview) >> 8;
-        else
-            tr->overview -= (tr->overview - w) >> 17;
+            if ((n * 2 + 1) << (level - 1) >= end) { /* no second half */
+                p[n] = *x;
+                continue;
+            }
 
-        block->overview[fill / TRACK_OVERVIEW_RES] = tr->overview >> 24;
+            p[n].min = x->min < y->min ? x->min : y->min;
+            p[n].max = x->max > y->max ? x->max : y->max;
+            p[n].rms = sqrt((x->rms * x->rms + y->rms * y->rms) / 2.0);
+        }
+    }
+}
+
+/*
+ * Get the waveform summary of 2^level samples from the given sample,
+ * which must be a multiple of that
+ *
+ * For the highest resolutions, the summary is made from the audio.
+ */
 
-        fill++;
-        pcm += TRACK_CHANNELS;
+void track_get_summary(struct track *tr, int s, int level,
+                       struct track_peak *peak)
+{
+    unsigned int len;
+
+    assert(level >= 0 && level <= TRACK_PEAK_MAX);
+    assert(s >= 0 && s < tr->length);
+
+    if (level >= TRACK_PEAK_MIN) {
+        *peak = *track_get_peak(tr, s, level);
+        return;
+    }
+
+    len = 1 << level;
+    if (s + len > tr->length)
+        len = tr->length - s;
+
+    summarise(track_get_sample(tr, s), len, peak);
+}
+
+/*
+ * Meter new audio for the slow-metering overview
+ *
+ * The level of each sample is taken first, in a loop which the
+ * compiler can vectorise. The meter only releases over a chunk whose
+ * peak does not reach it, and the release is linear, so it is run
+ * once for the chunk from the sum of the levels; this is most of real
+ * audio. Otherwise the meter is run over each sample. Only the last
+ * value of each entry of the overview is stored.
+ */
+
+static void meter_overview(struct track_import *im, const signed short *pcm,
+                           unsigned int fill, unsigned int samples,
+                           unsigned char *out)
+{
+    unsigned int overview;
+
+    overview = im->overview;
+
+    while (samples > 0) {
+        unsigned short v[OVERVIEW_CHUNK];
+        unsigned int n, len, peak, sum;
+
+        len = TRACK_OVERVIEW_RES - fill % TRACK_OVERVIEW_RES;
+        if (len > OVERVIEW_CHUNK)
+            len = OVERVIEW_CHUNK;
+        if (len > samples)
+            len = samples;
+
+        for (n = 0; n < len; n++)
+            v[n] = abs(pcm[n * 2]) + abs(pcm[n * 2 + 1]);
+
+        peak = 0;
+        sum = 0;
+
+        for (n = 0; n < len; n++) {
+            peak = v[n] > peak ? v[n] : peak;
+            sum += v[n];
+        }
+
+        if (peak << 16 <= overview) {
+            unsigned long long d;
+
+            d = (unsigned long long)overview * len
+                - ((unsigned long long)sum << 16);
+            overview -= d >> 17;
+        } else {
+            /* Fixed point arithmetic, with a fast attack and slow
+             * release; without a branch, which would be mispredicted */
+
+            for (n = 0; n < len; n++) {
+                unsigned int w;
+
+                w = (unsigned int)v[n] << 16;
+                overview = w > overview ? overview + ((w - overview) >> 8)
+                    : overview - ((overview - w) >> 17);
+            }
+        }
+
+        fill += len;
+        pcm += len * TRACK_CHANNELS;
+        samples -= len;
+
+        out[(fill - 1) / TRACK_OVERVIEW_RES] = overview >> 24;
+    }
+
+    im->overview = overview;
+}
+
+/*
+ * Notify that audio has been placed in the buffer
+ *
+ * The parameters are the first sample, and the number of stereo
+ * samples which have been placed in the buffer.
+ */
+
+static void commit_pcm_samples(struct track *tr, struct track_import *im,
+                               unsigned int s, unsigned int samples)
+{
+    unsigned int fill, end;
+    signed short *pcm;
+    struct track_block *block;
+
+    if (samples == 0)
+        return;
+
+    block = tr->block[s / TRACK_BLOCK_SAMPLES];
+    fill = s % TRACK_BLOCK_SAMPLES;
+    pcm = block->pcm + TRACK_CHANNELS * fill;
+
+    assert(samples <= TRACK_BLOCK_SAMPLES - fill);
+
+    update_peaks(block, fill, fill + samples);
+    bands_process(&im->bands, pcm, fill, samples, block->band,
+                  TRACK_BAND_SHIFT);
+    meter_overview(im, pcm, fill, samples, block->overview);
+
+    end = s + samples;
+
+    /* The audio ahead leaves a hole back to the main import; set it
+     * before the length covers it */
+
+    if (im == &tr->ahead && tr->hole_end == 0) {
+        tr->hole_start = import_end(&tr->import);
+        tr->hole_end = tr->ahead.start;
+        __sync_synchronize();
+    }
+
+    /* The main import fills the hole */
+
+    if (im == &tr->import && s == tr->hole_start && s < tr->hole_end) {
+        __sync_synchronize();
+        tr->hole_start = end < tr->hole_end ? end : tr->hole_end;
     }
 
     /* Increment the track length. A memory barrier ensures the
      * realtime or UI thread does not access garbage audio */
 
-    __sync_fetch_and_add(&tr->length, samples);
+    if (end > tr->length)
+        __sync_fetch_and_add(&tr->length, end - tr->length);
 }
 
 /*
@@ -199,10 +485,193 @@ static void commit_pcm_samples(struct track *tr, unsigned int samples)
  * and leaves the residual in the buffer ready for next time.
  */
 
-static void commit(struct track *tr, size_t len)
+static void commit(struct track *tr, struct track_import *im, size_t len)
+{
+    unsigned int s;
+
+    s = import_end(im);
+    im->bytes += len;
+    commit_pcm_samples(tr, im, s, import_end(im) - s);
+
+    if (im->first_audio == 0.0 && import_end(im) > im->start) {
+        im->first_audio = now();
+        stats_add(&first_audio, im->first_audio - im->requested);
+    }
+
+    if (im->first_block == 0.0
+        && import_end(im) - im->start >= TRACK_BLOCK_SAMPLES)
+    {
+        im->first_block = now();
+        stats_add(&first_block, im->first_block - im->requested);
+    }
+}
+
+/*
+ * Return: the number of importers which may run at once
+ */
+
+static unsigned int max_running(void)
 {
-    tr->bytes += len;
-    commit_pcm_samples(tr, tr->bytes / SAMPLE - tr->length);
+    static long cpus = 0;
+
+    if (cpus == 0)
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* Leave a CPU for the realtime thread and the interface, but
+     * allow for a track and the audio at its cue point */
+
+    return cpus > 3 ? cpus - 1 : 2;
+}
+
+/*
+ * Queue an import, behind any others of the same or higher priority
+ *
+ * Post: import is queued
+ */
+
+static void queue_import(struct track *tr, struct track_import *im,
+                         unsigned int start, int priority)
+{
+    struct track_import *x;
+
+    im->track = tr;
+    im->priority = priority;
+    im->queued = true;
+
+    im->pid = 0;
+    im->pe = NULL;
+    im->terminated = false;
+    im->complete = false;
+
+    im->start = start;
+    im->bytes = 0;
+    im->overview = 0;
+    bands_init(&im->bands, tr->rate);
+
+    im->requested = now();
+    im->spawned = 0.0;
+    im->first_audio = 0.0;
+    im->first_block = 0.0;
+    im->wakeups = 0;
+
+    list_for_each(x, &queue, queue) {
+        if (x->priority > priority)
+            break;
+    }
+
+    list_add_tail(&im->queue, &x->queue); /* before x */
+}
+
+/*
+ * Start an import process
+ *
+ * Return: 0 on success, or -1 on error
+ * Post: if 0 is returned, the import is running
+ */
+
+static int start_import(struct track_import *im)
+{
+    pid_t pid;
+    char rate[16], offset[32];
+    const char *importer, *path;
+    double begin;
+
+    begin = now();
+
+    importer = im->track->importer;
+    path = im->track->path;
+    sprintf(rate, "%d", im->track->rate);
+    sprintf(offset, "%0.6f", (double)im->start / im->track->rate);
+
+    /* Use a worker which is already running, if there is one */
+
+    im->worker = pool_import(&im->fd, importer, path, rate,
+                             im->start == 0 ? NULL : offset);
+
+    if (im->worker != NULL) {
+        pid = im->worker->pid;
+    } else {
+        if (im->start == 0) {
+            pid = fork_pipe_nb(&im->fd, importer, "import", path,
+                               rate, NULL);
+        } else {
+            pid = fork_pipe_nb(&im->fd, importer, "import", path,
+                               rate, offset, NULL);
+        }
+
+        if (pid == -1)
+            return -1;
+
+        make_background(pid);
+    }
+
+    /* The system may limit the size; if so, carry on regardless */
+
+    if (fcntl(im->fd, F_SETPIPE_SZ, IMPORT_PIPE) == -1)
+        debug("F_SETPIPE_SZ: %s", strerror(errno));
+
+    im->pid = pid;
+    running++;
+
+    im->spawned = now();
+    stats_add(&spawn, im->spawned - begin);
+
+    return 0;
+}
+
+/*
+ * Return: true if the queued import is no longer of any use,
+ * otherwise false
+ */
+
+static bool is_stale(const struct track_import *im)
+{
+    const struct track *tr = im->track;
+
+    if (im != &tr->ahead)
+        return false;
+
+    /* The main import may have got there first */
+
+    if (tr->import.pid == 0 && !tr->import.queued)
+        return true;
+
+    return import_end(&tr->import) >= tr->ahead.start;
+}
+
+/*
+ * Start as many of the queued imports as are allowed to run, in
+ * order of priority
+ *
+ * Pre: rig lock is held
+ */
+
+static void schedule(void)
+{
+    bool changed;
+
+    changed = false;
+
+    while (running < max_running() && !list_empty(&queue)) {
+        struct track_import *im;
+
+        im = list_entry(queue.next, struct track_import, queue);
+        list_del(&im->queue);
+        im->queued = false;
+        changed = true;
+
+        if (is_stale(im))
+            continue;
+
+        if (start_import(im) == -1 && im == &im->track->import)
+            status_printf(STATUS_ALERT, "Error importing %s", im->track->path);
+    }
+
+    /* The rig polls on any new imports, and lets go of tracks which
+     * are no longer importing */
+
+    if (changed)
+        rig_wake();
 }
 
 /*
@@ -213,35 +682,35 @@ static void commit(struct track *tr, size_t len)
  * Post: track is importing
  */
 
-static int track_init(struct track *t, const char *importer, const char *path)
+static int track_init(struct track *t, const char *importer, const char *path,
+                      int rate)
 {
-    pid_t pid;
-
     fprintf(stderr, "Importing '%s'...\n", path);
 
-    pid = fork_pipe_nb(&t->fd, importer, "import", path, STR(RATE), NULL);
-    if (pid == -1)
-        return -1;
-
-    t->pid = pid;
-    t->pe = NULL;
-    t->terminated = false;
+    t->ahead.pid = 0;
+    t->ahead.queued = false;
+    t->ahead.complete = false;
+    t->ahead.start = 0;
+    t->wanted = 0;
+    event_init(&t->destroy);
 
     t->refcount = 0;
 
     t->blocks = 0;
-    t->rate = RATE;
+    t->rate = rate;
 
-    t->bytes = 0;
     t->length = 0;
-    t->ppm = 0;
-    t->overview = 0;
+    t->hole_start = 0;
+    t->hole_end = 0;
 
     t->importer = importer;
     t->path = path;
 
+    queue_import(t, &t->import, 0, IMPORT_DECK);
+
     list_add(&t->tracks, &tracks);
     rig_post_track(t);
+    schedule();
 
     return 0;
 }
@@ -260,7 +729,10 @@ static void track_clear(struct track *tr)
 {
     int n;
 
-    assert(tr->pid == 0);
+    assert(!track_is_importing(tr));
+
+    fire(&tr->destroy, tr);
+    event_clear(&tr->destroy);
 
     for (n = 0; n < tr->blocks; n++)
         free(tr->block[n]);
@@ -291,13 +763,27 @@ static struct track* track_get_again(const char *importer, const char *path)
 /*
  * Get a pointer to a track object for the given importer and path
  *
+ * The audio is imported at the given sample rate, up to
+ * TRACK_MAX_RATE, so that it can be played without a second
+ * conversion. A track which is already in memory is used at whatever
+ * rate it was imported; the player takes care of the difference.
+ *
  * Return: pointer, or NULL if not enough resources
  */
 
-struct track* track_acquire_by_import(const char *importer, const char *path)
+struct track* track_acquire_by_import(const char *importer, const char *path,
+                                      int rate)
 {
     struct track *t;
 
+    assert(rate > 0);
+
+    /* A higher rate would shorten the longest track we can hold,
+     * and use more memory, for no audible gain */
+
+    if (rate > TRACK_MAX_RATE)
+        rate = TRACK_MAX_RATE;
+
     t = track_get_again(importer, path);
     if (t != NULL)
         return t;
@@ -308,7 +794,7 @@ struct track* track_acquire_by_import(const char *importer, const char *path)
         return NULL;
     }
 
-    if (track_init(t, importer, path) == -1) {
+    if (track_init(t, importer, path, rate) == -1) {
         free(t);
         return NULL;
     }
@@ -339,14 +825,32 @@ void track_acquire(struct track *t)
  * Request premature termination of an import operation
  */
 
-static void terminate(struct track *t)
+static void terminate(struct track_import *im)
 {
-    assert(t->pid != 0);
+    assert(im->pid != 0);
 
-    if (kill(t->pid, SIGTERM) == -1)
+    if (im->worker != NULL) {
+        worker_cancel(im->worker, im->fd);
+        im->fd = -1;
+    } else if (kill(im->pid, SIGTERM) == -1) {
         abort();
+    }
 
-    t->terminated = true;
+    im->terminated = true;
+}
+
+/*
+ * Cancel an import, whether it is running or queued
+ */
+
+static void cancel(struct track_import *im)
+{
+    if (im->queued) {
+        list_del(&im->queue);
+        im->queued = false;
+    } else if (im->pid != 0 && !im->terminated) {
+        terminate(im);
+    }
 }
 
 /*
@@ -360,8 +864,13 @@ void track_release(struct track *t)
     /* When importing, a reference is held. If it's the
      * only one remaining terminate it to save resources */
 
-    if (t->refcount == 1 && t->pid != 0) {
-        terminate(t);
+    if (t->refcount == 1 && track_is_importing(t)) {
+        cancel(&t->import);
+        cancel(&t->ahead);
+
+        if (!track_is_importing(t))
+            rig_wake(); /* to let go of the track */
+
         return;
     }
 
@@ -373,20 +882,116 @@ void track_release(struct track *t)
 }
 
 /*
- * Get entry for use by poll()
+ * Import the audio from the given position as soon as possible
+ *
+ * A second import is queued from a little before the position, and
+ * the main import stops when it reaches there. This is only done
+ * once for each track, and only if the position is well ahead of the
+ * main import.
+ *
+ * Pre: rig lock is held
+ */
+
+void track_import_ahead(struct track *tr, double seconds)
+{
+    long long s;
+
+    if (tr->import.pid == 0 || tr->import.terminated || tr->ahead.start != 0)
+        return;
+
+    s = (seconds - AHEAD_PREROLL) * tr->rate;
+
+    /* Begin the audio ahead on a boundary of the waveform summary,
+     * so that it does not depend on audio from the main import */
+
+    s &= ~((1LL << TRACK_PEAK_MAX) - 1);
+
+    if (s < import_end(&tr->import) + AHEAD_MIN * tr->rate)
+        return;
+
+    if (s >= (long long)TRACK_MAX_BLOCKS * TRACK_BLOCK_SAMPLES)
+        return;
+
+    fprintf(stderr, "Importing '%s' from %0.1f seconds...\n",
+            tr->path, (double)s / tr->rate);
+
+    queue_import(tr, &tr->ahead, s, IMPORT_CUE);
+    schedule();
+}
+
+/*
+ * Ask for the audio from the given position to be imported ahead,
+ * from any thread, including the realtime thread
  *
- * Pre: track is importing
- * Post: *pe contains poll entry
+ * The request is taken up by the rig; it is woken often by a track
+ * which is importing, which is the only time the request has any
+ * effect. A later request replaces one not yet taken up.
+ */
+
+void track_want_ahead(struct track *tr, double seconds)
+{
+    long long s;
+
+    s = seconds * tr->rate;
+    if (s < 0 || s >= UINT_MAX)
+        return;
+
+    __atomic_store_n(&tr->wanted, (unsigned int)s + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Return: file descriptor to wait on for the given import
  */
 
-void track_pollfd(struct track *t, struct pollfd *pe)
+static int import_fd(const struct track_import *im)
 {
-    assert(t->pid != 0);
+    /* A cancelled request is waiting only for the worker to give
+     * its status */
 
-    pe->fd = t->fd;
-    pe->events = POLLIN;
+    if (im->fd == -1)
+        return im->worker->fd;
 
-    t->pe = pe;
+    return im->fd;
+}
+
+/*
+ * Get entries for use by poll()
+ *
+ * Return: number of entries used, which is zero if every import is
+ * queued or cancelled
+ * Post: pe[0] and, if 2 is returned, pe[1] contain poll entries
+ */
+
+size_t track_pollfd(struct track *t, struct pollfd *pe)
+{
+    size_t n;
+
+    n = 0;
+
+    if (t->import.pid != 0) {
+        pe[n].fd = import_fd(&t->import);
+        pe[n].events = POLLIN;
+        pe[n].revents = 0;
+
+        /* Do not read beyond the audio imported ahead, and leave the
+         * importer waiting */
+
+        if (ahead_of(t, &t->import)
+            && import_end(&t->import) == t->ahead.start)
+        {
+            pe[n].fd = -1;
+        }
+
+        t->import.pe = &pe[n++];
+    }
+
+    if (t->ahead.pid != 0) {
+        pe[n].fd = import_fd(&t->ahead);
+        pe[n].events = POLLIN;
+        t->ahead.pe = &pe[n++];
+    }
+
+    return n;
 }
 
 /*
@@ -396,18 +1001,23 @@ void track_pollfd(struct track *t, struct pollfd *pe)
  * Return: -1 on completion, otherwise zero
  */
 
-static int read_from_pipe(struct track *tr)
+static int read_from_pipe(struct track *tr, struct track_import *im)
 {
+    im->wakeups++;
+
     for (;;) {
         void *pcm;
         size_t len;
         ssize_t z;
 
-        pcm = access_pcm(tr, &len);
+        if (ahead_of(tr, im) && import_end(im) == tr->ahead.start)
+            return 0; /* see track_pollfd() */
+
+        pcm = access_pcm(tr, im, &len);
         if (pcm == NULL)
             return -1;
 
-        z = read(tr->fd, pcm, len);
+        z = read(im->fd, pcm, len);
         if (z == -1) {
             if (errno == EAGAIN) {
                 return 0;
@@ -420,40 +1030,107 @@ static int read_from_pipe(struct track *tr)
         if (z == 0) /* EOF */
             break;
 
-        commit(tr, z);
+        commit(tr, im, z);
     }
 
+    im->complete = true;
     return -1; /* completion without error */
 }
 
+/*
+ * Measure an import which has completed, and report on it
+ */
+
+static void report(const struct track *tr, const struct track_import *im)
+{
+    double elapsed, mb;
+
+    elapsed = now() - im->spawned;
+    mb = im->bytes / 1e6;
+
+    stats_add(&decode, elapsed);
+    if (elapsed > 0.0)
+        stats_add(&throughput, mb / elapsed);
+    if (mb > 0.0)
+        stats_add(&wakeups, im->wakeups / mb);
+
+    fprintf(stderr, "Track import completed in %0.2fs, %0.1fMB/s, "
+            "first audio after %0.3fs, %u wakeups\n", elapsed,
+            elapsed > 0.0 ? mb / elapsed : 0.0,
+            im->first_audio == 0.0 ? 0.0 : im->first_audio - im->requested,
+            im->wakeups);
+
+    if (im != &tr->import || im->first_audio == 0.0)
+        return;
+
+    status_printf(STATUS_VERBOSE, "Track imported at %0.1fMB/s; first audio "
+                  "after %0.0fms (median %0.0fms of %lu imports)",
+                  elapsed > 0.0 ? mb / elapsed : 0.0,
+                  (im->first_audio - im->requested) * 1e3,
+                  stats_percentile(&first_audio, 50.0) * 1e3,
+                  first_audio.count);
+}
+
 /*
  * Synchronise with the import process and complete it
  *
- * Pre: track is importing
- * Post: track is not importing
+ * Pre: import is running
+ * Post: import is not running
  */
 
-static void stop_import(struct track *t)
+static void stop_import(struct track *t, struct track_import *im)
 {
     int status;
+    bool ok;
 
-    assert(t->pid != 0);
+    assert(im->pid != 0);
 
-    if (close(t->fd) == -1)
-        abort();
+    if (im->worker != NULL) {
+        status = worker_wait(im->worker, im->fd);
+        ok = (status == EXIT_SUCCESS);
+    } else {
+        if (close(im->fd) == -1)
+            abort();
 
-    if (waitpid(t->pid, &status, 0) == -1)
-        abort();
+        if (waitpid(im->pid, &status, 0) == -1)
+            abort();
+
+        ok = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    }
 
-    if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
-        fprintf(stderr, "Track import completed\n");
+    if (ok) {
+        report(t, im);
     } else {
         fprintf(stderr, "Track import completed with status %d\n", status);
-        if (!t->terminated)
+        im->complete = false;
+        if (!im->terminated && im == &t->import)
             status_printf(STATUS_ALERT, "Error importing %s", t->path);
     }
 
-    t->pid = 0;
+    if (im == &t->ahead && im->bytes == 0)
+        im->complete = false; /* nothing to join up with */
+
+    im->pid = 0;
+    running--;
+
+    schedule();
+}
+
+/*
+ * Complete the main import if it has reached the audio imported
+ * ahead
+ */
+
+static void join(struct track *t)
+{
+    if (t->import.pid == 0 || !t->ahead.complete)
+        return;
+
+    if (import_end(&t->import) != t->ahead.start)
+        return;
+
+    terminate(&t->import);
+    stop_import(t, &t->import);
 }
 
 /*
@@ -462,23 +1139,41 @@ static void stop_import(struct track *t)
  * Return: true if import has completed, otherwise false
  */
 
-void track_handle(struct track *tr)
+static void handle(struct track *tr, struct track_import *im)
 {
-    assert(tr->pid != 0);
+    if (im->pid == 0)
+        return;
 
-    /* A track may be added while poll() was waiting,
+    /* An import may be started while poll() was waiting,
      * in which case it has no return data from poll */
 
-    if (tr->pe == NULL)
+    if (im->pe == NULL)
         return;
 
-    if (tr->pe->revents == 0)
+    if (im->pe->revents == 0)
         return;
 
-    if (read_from_pipe(tr) != -1)
+    if (im->fd != -1 && read_from_pipe(tr, im) != -1)
+        return;
+
+    stop_import(tr, im);
+}
+
+void track_handle(struct track *tr)
+{
+    unsigned int wanted;
+
+    wanted = __atomic_exchange_n(&tr->wanted, 0, __ATOMIC_RELAXED);
+    if (wanted != 0)
+        track_import_ahead(tr, (double)(wanted - 1) / tr->rate);
+
+    handle(tr, &tr->import);
+    handle(tr, &tr->ahead);
+    join(tr);
+
+    if (track_is_importing(tr))
         return;
 
-    stop_import(tr);
     list_del(&tr->rig);
     track_release(tr); /* may delete the track */
 }
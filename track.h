@@ -21,22 +21,84 @@
 #define TRACK_H
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <sys/poll.h>
 #include <sys/types.h>
 
+#include "bands.h"
 #include "list.h"
+#include "observer.h"
+#include "pool.h"
 
 #define TRACK_CHANNELS 2
 
 #define TRACK_MAX_BLOCKS 64
 #define TRACK_BLOCK_SAMPLES (2048 * 1024)
-#define TRACK_PPM_RES 64
+
+/* Audio is imported at no more than this rate, above which the
+ * player converts it; the blocks then hold over 46 minutes of audio,
+ * and a track uses no more than 10% more memory than at 44.1kHz */
+
+#define TRACK_MAX_RATE 48000
 #define TRACK_OVERVIEW_RES 2048
+#define TRACK_BAND_SHIFT 8 /* 2^n samples for each band meter */
+
+/* The waveform is summarised over every power of two samples, from
+ * 2^TRACK_PEAK_MIN to 2^TRACK_PEAK_MAX, in successive levels */
+
+#define TRACK_PEAK_MIN 4
+#define TRACK_PEAK_MAX 16
+#define TRACK_PEAK_ENTRIES ((TRACK_BLOCK_SAMPLES >> (TRACK_PEAK_MIN - 1)) \
+                            - (TRACK_BLOCK_SAMPLES >> TRACK_PEAK_MAX))
+
+struct track_peak {
+    signed char min, max; /* of the mono signal */
+    unsigned char rms;
+};
 
 struct track_block {
     signed short pcm[TRACK_BLOCK_SAMPLES * TRACK_CHANNELS];
-    unsigned char ppm[TRACK_BLOCK_SAMPLES / TRACK_PPM_RES],
-        overview[TRACK_BLOCK_SAMPLES / TRACK_OVERVIEW_RES];
+    struct track_peak peak[TRACK_PEAK_ENTRIES];
+    unsigned char overview[TRACK_BLOCK_SAMPLES / TRACK_OVERVIEW_RES],
+        band[TRACK_BLOCK_SAMPLES >> TRACK_BAND_SHIFT][BANDS];
+};
+
+/* Priority of an import, highest first */
+
+enum {
+    IMPORT_DECK, /* loaded on a deck */
+    IMPORT_CUE /* the audio at a cue point */
+};
+
+/* An import process, and the state of the audio coming from it */
+
+struct track_import {
+    struct track *track;
+
+    /* Waiting for other imports to complete */
+
+    struct list queue;
+    int priority;
+    bool queued;
+
+    pid_t pid;
+    struct worker *worker; /* or NULL if the process is our own */
+    int fd;
+    struct pollfd *pe;
+    bool terminated, complete;
+
+    unsigned int start; /* sample at which the audio begins */
+    size_t bytes; /* loaded in */
+
+    /* Current value of audio meters when loading */
+
+    unsigned int overview;
+    struct bands bands;
+
+    /* Times of progress, for measurement; or 0.0 if yet to happen */
+
+    double requested, spawned, first_audio, first_block;
+    unsigned int wakeups; /* of the rig, to read audio */
 };
 
 struct track {
@@ -48,53 +110,76 @@ struct track {
    
     const char *importer, *path;
     
-    size_t bytes; /* loaded in */
     unsigned int length, /* track length in samples */
+        hole_start, hole_end, /* within the length, not yet imported */
         blocks; /* number of blocks allocated */
     struct track_block *block[TRACK_MAX_BLOCKS];
 
-    /* State of audio import */
+    /* State of audio import; optionally, a second import begins part
+     * way into the track so that a cue point can be reached sooner */
 
     struct list rig;
-    pid_t pid;
-    int fd;
-    struct pollfd *pe;
-    bool terminated;
+    struct track_import import, ahead;
+    unsigned int wanted; /* sample to import ahead, plus one; or 0 */
 
-    /* Current value of audio meters when loading */
-    
-    unsigned short ppm;
-    unsigned int overview;
+    struct event destroy; /* fired as the track is freed */
 };
 
 void track_use_mlock(void);
+void track_dump_stats(FILE *f);
+void track_import_ahead(struct track *tr, double seconds);
+void track_want_ahead(struct track *tr, double seconds);
+
+void track_get_summary(struct track *tr, int s, int level,
+                       struct track_peak *peak);
 
 /* Tracks are dynamically allocated and reference counted */
 
-struct track* track_acquire_by_import(const char *importer, const char *path);
+struct track* track_acquire_by_import(const char *importer, const char *path,
+                                      int rate);
 struct track* track_acquire_empty(void);
 void track_acquire(struct track *t);
 void track_release(struct track *t);
 
 /* Functions used by the rig and main thread */
 
-void track_pollfd(struct track *tr, struct pollfd *pe);
+size_t track_pollfd(struct track *tr, struct pollfd *pe);
 void track_handle(struct track *tr);
 
 /* Return true if the track importer is running, otherwise false */
 
 static inline bool track_is_importing(struct track *tr)
 {
-    return tr->pid != 0;
+    return tr->import.pid != 0 || tr->import.queued
+        || tr->ahead.pid != 0 || tr->ahead.queued;
+}
+
+/* Return true if the given sample has been imported */
+
+static inline bool track_is_filled(struct track *tr, int s)
+{
+    return s >= 0 && s < tr->length
+        && (s < tr->hole_start || s >= tr->hole_end);
+}
+
+/* Return the offset of a level of the waveform summary in a block */
+
+static inline size_t track_peak_offset(int level)
+{
+    return (TRACK_BLOCK_SAMPLES >> (TRACK_PEAK_MIN - 1))
+        - (TRACK_BLOCK_SAMPLES >> (level - 1));
 }
 
-/* Return the pseudo-PPM meter value for the given sample */
+/* Return the summary of 2^level samples from the given sample, which
+ * must be a multiple of that; see also track_get_summary() */
 
-static inline unsigned char track_get_ppm(struct track *tr, int s)
+static inline const struct track_peak* track_get_peak(struct track *tr,
+                                                      int s, int level)
 {
     struct track_block *b;
     b = tr->block[s / TRACK_BLOCK_SAMPLES];
-    return b->ppm[(s % TRACK_BLOCK_SAMPLES) / TRACK_PPM_RES];
+    return &b->peak[track_peak_offset(level)
+                    + ((s % TRACK_BLOCK_SAMPLES) >> level)];
 }
 
 /* Return the overview meter value for the given sample */
@@ -106,6 +191,15 @@ static inline unsigned char track_get_overview(struct track *tr, int s)
     return b->overview[(s % TRACK_BLOCK_SAMPLES) / TRACK_OVERVIEW_RES];
 }
 
+/* Return the meters of each frequency band for the given sample */
+
+static inline const unsigned char* track_get_bands(struct track *tr, int s)
+{
+    struct track_block *b;
+    b = tr->block[s / TRACK_BLOCK_SAMPLES];
+    return b->band[(s % TRACK_BLOCK_SAMPLES) >> TRACK_BAND_SHIFT];
+}
+
 /* Return a pointer to (not value of) the sample data for each channel */
 
 static inline signed short* track_get_sample(struct track *tr, int s)
@@ -28,17 +28,21 @@
 #include <SDL.h> /* may override main() */
 
 #include "alsa.h"
+#include "beat.h"
 #include "controller.h"
 #include "device.h"
 #include "dicer.h"
 #include "dummy.h"
+#include "external.h"
 #include "interface.h"
 #include "jack.h"
 #include "library.h"
 #include "oss.h"
+#include "pool.h"
 #include "realtime.h"
 #include "thread.h"
 #include "rig.h"
+#include "store.h"
 #include "timecoder.h"
 #include "track.h"
 #include "xwax.h"
@@ -50,6 +54,8 @@
 
 #define DEFAULT_RATE 44100
 #define DEFAULT_PRIORITY 80
+#define DEFAULT_UI_CPU 50 /* per cent */
+#define DEFAULT_BEAT_THREADS 1
 
 #define DEFAULT_IMPORTER EXECDIR "/xwax-import"
 #define DEFAULT_SCANNER EXECDIR "/xwax-scan"
@@ -72,6 +78,7 @@ static struct rt rt;
 static double speed;
 static bool protect, phono;
 static const char *importer, *cueloader;
+static bool cue_store;
 static struct timecode_def *timecode;
 
 static void usage(FILE *fd)
@@ -83,8 +90,14 @@ static void usage(FILE *fd)
       "  -q <n>         Real-time priority (0 for no priority, default %d)\n"
       "  -g <s>         Set display geometry (see man page)\n"
       "  --no-decor     Request a window with no decorations\n"
+      "  --ui-cpu <n>   Limit the display to n%% of a CPU (default %d)\n"
+      "  --import-workers <n>  Keep n importers running (default 0)\n"
+      "  --import-stats <path> Write measurements of imports on exit\n"
+      "  --cue-store <path>    File of cue points (see man page)\n"
+      "  --beat-threads <n>    Analyse tempo with n threads (default %d)\n"
+      "  --beat-store <path>   File of tempo analysis (see man page)\n"
       "  -h             Display this message to stdout and exit\n\n",
-      DEFAULT_PRIORITY);
+      DEFAULT_PRIORITY, DEFAULT_UI_CPU, DEFAULT_BEAT_THREADS);
 
     fprintf(fd, "Music library options:\n"
       "  -l <path>      Location to scan for audio tracks\n"
@@ -99,7 +112,7 @@ static void usage(FILE *fd)
       "  -u             Allow all operations when playing\n"
       "  --line         Line level signal (default)\n"
       "  --phono        Tolerate cartridge level signal ('software pre-amp')\n"
-      "  --cue <program>  Cue point loader (default '%s')\n"
+      "  --cue <program>  Cue point loader (default is built-in, then '%s')\n"
       "  -i <program>   Importer (default '%s')\n"
       "  --dummy        Build a dummy deck with no audio device\n\n",
       DEFAULT_CUELOADER, DEFAULT_IMPORTER);
@@ -169,7 +182,8 @@ static int commit_deck(void)
 
     d = &deck[ndeck];
 
-    r = deck_init(d, &rt, timecode, importer, cueloader, speed, phono, protect);
+    r = deck_init(d, &rt, timecode, importer, cueloader, cue_store,
+                  speed, phono, protect);
     if (r == -1)
         return -1;
 
@@ -183,10 +197,36 @@ static int commit_deck(void)
     return 0;
 }
 
+/*
+ * Write the measurements of imports to a file
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int dump_stats(const char *pathname)
+{
+    FILE *f;
+
+    f = fopen(pathname, "w");
+    if (f == NULL) {
+        perror("fopen");
+        return -1;
+    }
+
+    track_dump_stats(f);
+
+    if (fclose(f) != 0) {
+        perror("fclose");
+        return -1;
+    }
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
-    int rc = -1, n, priority;
-    const char *scanner, *geo;
+    int rc = -1, n, priority, ui_cpu, workers, beat_threads;
+    const char *scanner, *geo, *stats, *cuestore, *beatstore;
     char *endptr;
     bool use_mlock, decor;
 
@@ -226,9 +266,15 @@ int main(int argc, char *argv[])
     decor = true;
     nctl = 0;
     priority = DEFAULT_PRIORITY;
+    ui_cpu = DEFAULT_UI_CPU;
+    stats = NULL;
+    cuestore = NULL;
+    beat_threads = DEFAULT_BEAT_THREADS;
+    beatstore = NULL;
     importer = DEFAULT_IMPORTER;
     scanner = DEFAULT_SCANNER;
     cueloader = DEFAULT_CUELOADER;
+    cue_store = true;
     timecode = NULL;
     speed = 1.0;
     protect = false;
@@ -521,6 +567,117 @@ int main(int argc, char *argv[])
             argv++;
             argc--;
 
+        } else if (!strcmp(argv[0], "--ui-cpu")) {
+
+            if (argc < 2) {
+                fprintf(stderr, "--ui-cpu requires an integer argument.\n");
+                return -1;
+            }
+
+            ui_cpu = strtol(argv[1], &endptr, 10);
+            if (*endptr != '\0') {
+                fprintf(stderr, "--ui-cpu requires an integer argument.\n");
+                return -1;
+            }
+
+            if (ui_cpu < 1 || ui_cpu > 100) {
+                fprintf(stderr, "CPU limit (%d%%) must be between 1 and "
+                        "100.\n", ui_cpu);
+                return -1;
+            }
+
+            argv += 2;
+            argc -= 2;
+
+        } else if (!strcmp(argv[0], "--import-workers")) {
+
+            if (argc < 2) {
+                fprintf(stderr, "--import-workers requires an integer "
+                        "argument.\n");
+                return -1;
+            }
+
+            workers = strtol(argv[1], &endptr, 10);
+            if (*endptr != '\0') {
+                fprintf(stderr, "--import-workers requires an integer "
+                        "argument.\n");
+                return -1;
+            }
+
+            if (workers < 0) {
+                fprintf(stderr, "Number of import workers (%d) must be "
+                        "zero or positive.\n", workers);
+                return -1;
+            }
+
+            pool_use_workers(workers);
+
+            argv += 2;
+            argc -= 2;
+
+        } else if (!strcmp(argv[0], "--import-stats")) {
+
+            if (argc < 2) {
+                fprintf(stderr, "--import-stats requires a pathname "
+                        "argument.\n");
+                return -1;
+            }
+
+            stats = argv[1];
+
+            argv += 2;
+            argc -= 2;
+
+        } else if (!strcmp(argv[0], "--cue-store")) {
+
+            if (argc < 2) {
+                fprintf(stderr, "--cue-store requires a pathname "
+                        "argument.\n");
+                return -1;
+            }
+
+            cuestore = argv[1];
+
+            argv += 2;
+            argc -= 2;
+
+        } else if (!strcmp(argv[0], "--beat-threads")) {
+
+            if (argc < 2) {
+                fprintf(stderr, "--beat-threads requires an integer "
+                        "argument.\n");
+                return -1;
+            }
+
+            beat_threads = strtol(argv[1], &endptr, 10);
+            if (*endptr != '\0') {
+                fprintf(stderr, "--beat-threads requires an integer "
+                        "argument.\n");
+                return -1;
+            }
+
+            if (beat_threads < 0) {
+                fprintf(stderr, "Number of beat threads (%d) must be "
+                        "zero or positive.\n", beat_threads);
+                return -1;
+            }
+
+            argv += 2;
+            argc -= 2;
+
+        } else if (!strcmp(argv[0], "--beat-store")) {
+
+            if (argc < 2) {
+                fprintf(stderr, "--beat-store requires a pathname "
+                        "argument.\n");
+                return -1;
+            }
+
+            beatstore = argv[1];
+
+            argv += 2;
+            argc -= 2;
+
         } else if (!strcmp(argv[0], "-i")) {
 
             /* Importer script for subsequent decks */
@@ -547,6 +704,7 @@ int main(int argc, char *argv[])
             }
 
             cueloader = argv[1];
+            cue_store = false;
 
             argv += 2;
             argc -= 2;
@@ -623,6 +781,18 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    for (n = 0; n < ndeck; n++) {
+        if (!deck[n].cue_store)
+            continue;
+
+        if (store_open(&cues_store, cuestore) == -1)
+            fprintf(stderr, "Cue points will not be saved.\n");
+        break;
+    }
+
+    if (store_open(&beats_store, beatstore) == -1)
+        fprintf(stderr, "Analysis of tempo will not be saved.\n");
+
     rc = EXIT_FAILURE; /* until clean exit */
 
     /* Order is important: launch realtime thread first, then mlock.
@@ -631,12 +801,18 @@ int main(int argc, char *argv[])
     if (rt_start(&rt, priority) == -1)
         return -1;
 
+    if (rt.cpu != -1)
+        background_avoid_cpu(rt.cpu);
+
     if (use_mlock && mlockall(MCL_CURRENT) == -1) {
         perror("mlockall");
         goto out_rt;
     }
 
-    if (interface_start(&library, geo, decor) == -1)
+    if (beat_init(&library, beat_threads) == -1)
+        fprintf(stderr, "Tracks will not be analysed.\n");
+
+    if (interface_start(&library, geo, decor, ui_cpu) == -1)
         goto out_rt;
 
     if (rig_main() == -1)
@@ -649,6 +825,7 @@ out_interface:
     interface_stop();
 out_rt:
     rt_stop(&rt);
+    beat_clear();
 
     for (n = 0; n < ndeck; n++)
         deck_clear(&deck[n]);
@@ -659,7 +836,13 @@ out_rt:
     timecoder_free_lookup();
     library_clear(&library);
     rt_clear(&rt);
+    pool_clear();
     rig_clear();
+    store_close(&cues_store);
+    store_close(&beats_store);
+
+    if (stats != NULL && dump_stats(stats) == -1)
+        rc = EXIT_FAILURE;
     library_global_clear();
     thread_global_clear();
 